@@ -0,0 +1,51 @@
+/*
+ * A native replacement for java cs241.binasm, built on the assembler in mipsasm.c.
+ *
+ *     binasm < prog.asm > prog.mips
+ *
+ * Reads a CS241 MIPS assembly language program from stdin and writes its machine code to stdout. If the
+ * program is invalid nothing is written to stdout; the reason goes to stderr and the exit status is 1.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mipsasm.h"
+
+int main( int argc, char * argv[] ) {
+
+    size_t         capacity = 64 * 1024, length = 0, got;
+    char         * text     = malloc( capacity );
+    MipsAssembly   program;
+
+    if( argc != 1 ) {
+        fprintf( stderr, "usage: %s < prog.asm > prog.mips\n", argv[0] );
+        return 1;
+    }
+    while( text != NULL && (got = fread( text + length, 1, capacity - length, stdin )) > 0 ) {
+        length += got;
+        if( length == capacity ) {
+            char * grown = realloc( text, 2 * capacity );
+            if( grown == NULL ) free( text );
+            text      = grown;
+            capacity *= 2;
+        }
+    }
+    if( text == NULL || ferror( stdin ) ) {
+        fprintf( stderr, "ERROR: failed to read the input\n" );
+        return 1;
+    }
+
+    bool assembled = mipsAssemble( text, length, &program );
+    if( ! assembled ) {
+        fprintf( stderr, "%s\n", program.error );
+    } else if( ! mipsWriteProgram( stdout, program.words, program.nWords ) || fflush( stdout ) != 0 ) {
+        fprintf( stderr, "ERROR: failed to write the output\n" );
+        assembled = false;
+    }
+    freeMipsAssembly( &program );
+    free( text );
+    return assembled ? 0 : 1;
+}
@@ -0,0 +1,463 @@
+/*
+ * An assembler for the CS241 subset of MIPS assembly language. See mipsasm.h.
+ *
+ * The program is assembled in a single pass over the text. A label that hasn't been defined yet when it's
+ * used is recorded as a fixup against the word that uses it, and the fixups are resolved once the whole
+ * program has been seen.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mipsasm.h"
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Tokens.
+//
+// -----------------------------------------------------------------------------------------------------
+
+typedef enum {
+    TOKEN_END,                           // The end of the line (or of a comment, or of the text).
+    TOKEN_ID,                            // eg add.
+    TOKEN_LABEL,                         // eg loop: (text excludes the ':').
+    TOKEN_DOTWORD,                       // .word
+    TOKEN_REGISTER,                      // eg $31 (value is the register number).
+    TOKEN_INT,                           // eg -12
+    TOKEN_HEXINT,                        // eg 0xffff000c
+    TOKEN_COMMA,
+    TOKEN_LPAREN,
+    TOKEN_RPAREN,
+    TOKEN_INVALID
+} TokenKind;
+
+typedef struct Token {
+    TokenKind    kind;
+    const char * text;                   // A slice of the program's text.
+    int          length;
+    int64_t      value;                  // For REGISTER, INT and HEXINT.
+} Token;
+
+typedef struct Label {
+    const char * name;                   // A slice of the program's text; NULL for an empty slot.
+    int          length;
+    uint32_t     address;
+} Label;
+
+typedef enum { FIXUP_WORD, FIXUP_BRANCH } FixupKind;
+
+typedef struct Fixup {
+    FixupKind    kind;
+    size_t       wordIndex;              // The word that uses the label.
+    const char * name;
+    int          length;
+    int          line;
+} Fixup;
+
+typedef struct Assembler {
+    const char   * pos;                  // The next unscanned character of the current line.
+    const char   * lineEnd;
+    int            line;
+    MipsAssembly * program;
+
+    Label        * labels;               // An open-addressing hash table, kept at most half full.
+    size_t         labelCapacity;
+    size_t         nLabels;
+
+    Fixup        * fixups;
+    size_t         nFixups;
+    size_t         fixupCapacity;
+} Assembler;
+
+static bool isAlpha( char c ) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+static bool isDigit( char c ) { return c >= '0' && c <= '9'; }
+static bool isHex(   char c ) { return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'); }
+
+static bool asmError( Assembler * as, const char * format, ... ) {
+    va_list args;
+    int     length = snprintf( as->program->error, sizeof(as->program->error), "ERROR: line %d: ", as->line );
+    va_start( args, format );
+    vsnprintf( as->program->error + length, sizeof(as->program->error) - length, format, args );
+    va_end( args );
+    return false;
+}
+
+// Scan the next token of the current line. Numbers too big for 32 bits are clamped to a value that every
+// range check rejects.
+static void nextToken( Assembler * as, Token * token ) {
+    const char * p = as->pos;
+
+    while( p < as->lineEnd && (*p == ' ' || *p == '\t' || *p == '\r') ) p++;
+    token->text   = p;
+    token->value  = 0;
+
+    if( p == as->lineEnd || *p == ';' ) {
+        token->kind = TOKEN_END;
+        p = as->lineEnd;
+    } else if( isAlpha( *p ) ) {
+        while( p < as->lineEnd && (isAlpha( *p ) || isDigit( *p )) ) p++;
+        token->kind = TOKEN_ID;
+        if( p < as->lineEnd && *p == ':' ) {
+            token->kind   = TOKEN_LABEL;
+            token->length = p - token->text;
+            as->pos       = p + 1;
+            return;
+        }
+    } else if( *p == '.' ) {
+        p++;
+        while( p < as->lineEnd && isAlpha( *p ) ) p++;
+        token->kind = (p - token->text == 5 && ! strncmp( token->text, ".word", 5 )) ? TOKEN_DOTWORD : TOKEN_INVALID;
+    } else if( *p == '$' ) {
+        p++;
+        token->kind = p < as->lineEnd && isDigit( *p ) ? TOKEN_REGISTER : TOKEN_INVALID;
+        while( p < as->lineEnd && isDigit( *p ) ) {
+            if( token->value < 100 ) token->value = 10 * token->value + (*p - '0');
+            p++;
+        }
+    } else if( *p == '0' && p + 1 < as->lineEnd && p[1] == 'x' ) {
+        p += 2;
+        token->kind = p < as->lineEnd && isHex( *p ) ? TOKEN_HEXINT : TOKEN_INVALID;
+        while( p < as->lineEnd && isHex( *p ) ) {
+            int digit = isDigit( *p ) ? *p - '0' : (*p | 0x20) - 'a' + 10;
+            if( token->value <= 0xffffffffLL ) token->value = 16 * token->value + digit;
+            p++;
+        }
+    } else if( isDigit( *p ) || (*p == '-' && p + 1 < as->lineEnd && isDigit( p[1] )) ) {
+        bool negative = *p == '-';
+        if( negative ) p++;
+        token->kind = TOKEN_INT;
+        while( p < as->lineEnd && isDigit( *p ) ) {
+            if( token->value <= 0xffffffffLL ) token->value = 10 * token->value + (*p - '0');
+            p++;
+        }
+        if( negative ) token->value = -token->value;
+    } else if( *p == ',' ) { token->kind = TOKEN_COMMA;  p++;
+    } else if( *p == '(' ) { token->kind = TOKEN_LPAREN; p++;
+    } else if( *p == ')' ) { token->kind = TOKEN_RPAREN; p++;
+    } else {
+        token->kind = TOKEN_INVALID;
+        p++;
+    }
+
+    // A token has to be followed by whitespace, punctuation or the end of the line - "$1x" is an error.
+    if( (token->kind == TOKEN_ID || token->kind == TOKEN_REGISTER || token->kind == TOKEN_INT || token->kind == TOKEN_HEXINT
+                                 || token->kind == TOKEN_DOTWORD)
+        && p < as->lineEnd && (isAlpha( *p ) || isDigit( *p ) || *p == '$' || *p == '.' || *p == ':') ) {
+        token->kind = TOKEN_INVALID;
+        while( p < as->lineEnd && (isAlpha( *p ) || isDigit( *p )) ) p++;
+    }
+    token->length = p - token->text;
+    as->pos       = p;
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Labels and fixups.
+//
+// -----------------------------------------------------------------------------------------------------
+
+static uint32_t hashName( const char * name, int length ) {
+    uint32_t hash = 2166136261u;                                    // FNV-1a.
+    int      idx;
+    for( idx = 0; idx < length; idx++ ) {
+        hash ^= (unsigned char) name[idx];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static Label * findLabel( Assembler * as, const char * name, int length ) {
+    size_t mask = as->labelCapacity - 1;
+    size_t idx  = hashName( name, length ) & mask;
+    while( as->labels[idx].name != NULL ) {
+        Label * label = &as->labels[idx];
+        if( label->length == length && ! memcmp( label->name, name, length ) ) return label;
+        idx = (idx + 1) & mask;
+    }
+    return &as->labels[idx];                                         // The empty slot it would go in.
+}
+
+static bool defineLabel( Assembler * as, Token * token, uint32_t address ) {
+    if( 2 * (as->nLabels + 1) > as->labelCapacity ) {
+        Label  * old         = as->labels;
+        size_t   oldCapacity = as->labelCapacity;
+        size_t   idx;
+        as->labelCapacity *= 2;
+        as->labels         = calloc( as->labelCapacity, sizeof(Label) );
+        if( as->labels == NULL ) {
+            as->labels        = old;
+            as->labelCapacity = oldCapacity;
+            return asmError( as, "out of memory" );
+        }
+        for( idx = 0; idx < oldCapacity; idx++ ) {
+            if( old[idx].name != NULL ) *findLabel( as, old[idx].name, old[idx].length ) = old[idx];
+        }
+        free( old );
+    }
+    Label * label = findLabel( as, token->text, token->length );
+    if( label->name != NULL ) return asmError( as, "duplicate label %.*s", token->length, token->text );
+    label->name    = token->text;
+    label->length  = token->length;
+    label->address = address;
+    as->nLabels++;
+    return true;
+}
+
+static bool addFixup( Assembler * as, FixupKind kind, Token * token ) {
+    if( as->nFixups == as->fixupCapacity ) {
+        Fixup * grown = realloc( as->fixups, 2 * as->fixupCapacity * sizeof(Fixup) );
+        if( grown == NULL ) return asmError( as, "out of memory" );
+        as->fixups         = grown;
+        as->fixupCapacity *= 2;
+    }
+    Fixup * fixup     = &as->fixups[as->nFixups++];
+    fixup->kind       = kind;
+    fixup->wordIndex  = as->program->nWords;
+    fixup->name       = token->text;
+    fixup->length     = token->length;
+    fixup->line       = as->line;
+    return true;
+}
+
+static bool resolveFixups( Assembler * as ) {
+    size_t idx;
+    for( idx = 0; idx < as->nFixups; idx++ ) {
+        Fixup * fixup = &as->fixups[idx];
+        Label * label = findLabel( as, fixup->name, fixup->length );
+        as->line = fixup->line;
+        if( label->name == NULL ) return asmError( as, "undefined label %.*s", fixup->length, fixup->name );
+        if( fixup->kind == FIXUP_WORD ) {
+            as->program->words[fixup->wordIndex] = label->address;
+        } else {
+            int64_t offset = ((int64_t) label->address - 4 * ((int64_t) fixup->wordIndex + 1)) / 4;
+            if( offset < -32768 || offset > 32767 ) return asmError( as, "branch to %.*s out of range", fixup->length, fixup->name );
+            as->program->words[fixup->wordIndex] |= (uint32_t) offset & 0xffff;
+        }
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Instructions.
+//
+// -----------------------------------------------------------------------------------------------------
+
+typedef enum { FORMAT_DST, FORMAT_ST, FORMAT_D, FORMAT_S, FORMAT_MEMORY, FORMAT_BRANCH } Format;
+
+typedef struct Opcode {
+    const char * name;
+    Format       format;
+    uint32_t     bits;                   // The instruction with all of its operands zero.
+} Opcode;
+
+static const Opcode opcodes[] = {
+    { "add",   FORMAT_DST,    0x00000020 },
+    { "sub",   FORMAT_DST,    0x00000022 },
+    { "slt",   FORMAT_DST,    0x0000002a },
+    { "sltu",  FORMAT_DST,    0x0000002b },
+    { "mult",  FORMAT_ST,     0x00000018 },
+    { "multu", FORMAT_ST,     0x00000019 },
+    { "div",   FORMAT_ST,     0x0000001a },
+    { "divu",  FORMAT_ST,     0x0000001b },
+    { "mfhi",  FORMAT_D,      0x00000010 },
+    { "mflo",  FORMAT_D,      0x00000012 },
+    { "lis",   FORMAT_D,      0x00000014 },
+    { "jr",    FORMAT_S,      0x00000008 },
+    { "jalr",  FORMAT_S,      0x00000009 },
+    { "lw",    FORMAT_MEMORY, 0x8c000000 },
+    { "sw",    FORMAT_MEMORY, 0xac000000 },
+    { "beq",   FORMAT_BRANCH, 0x10000000 },
+    { "bne",   FORMAT_BRANCH, 0x14000000 },
+};
+
+#define NUM_OPCODES ((int) (sizeof(opcodes) / sizeof(opcodes[0])))
+
+static bool appendWord( Assembler * as, uint32_t word ) {
+    MipsAssembly * program = as->program;
+    if( program->nWords == program->capacity ) {
+        uint32_t * grown = realloc( program->words, 2 * program->capacity * sizeof(uint32_t) );
+        if( grown == NULL ) return asmError( as, "out of memory" );
+        program->words     = grown;
+        program->capacity *= 2;
+    }
+    program->words[program->nWords++] = word;
+    return true;
+}
+
+static bool expect( Assembler * as, TokenKind kind, Token * token, const char * what ) {
+    nextToken( as, token );
+    if( token->kind != kind ) return asmError( as, "expected %s but found \"%.*s\"", what, token->length, token->text );
+    if( kind == TOKEN_REGISTER && token->value > 31 ) return asmError( as, "invalid register $%.*s", token->length - 1, token->text + 1 );
+    return true;
+}
+
+// Read a register operand followed by whatever separates it from the next one.
+static bool registerOperand( Assembler * as, uint32_t * reg, TokenKind separator ) {
+    Token token;
+    if( ! expect( as, TOKEN_REGISTER, &token, "a register" ) ) return false;
+    *reg = (uint32_t) token.value;
+    if( separator == TOKEN_END ) return true;
+    return expect( as, separator, &token, separator == TOKEN_COMMA ? "','" : "')'" );
+}
+
+// Check that an immediate operand fits in 16 bits - signed if decimal, unsigned if hex.
+static bool immediateOperand( Assembler * as, Token * token, uint32_t * immediate ) {
+    if( token->kind == TOKEN_INT ) {
+        if( token->value < -32768 || token->value > 32767 ) return asmError( as, "immediate %.*s out of range", token->length, token->text );
+    } else if( token->kind == TOKEN_HEXINT ) {
+        if( token->value > 0xffff ) return asmError( as, "immediate %.*s out of range", token->length, token->text );
+    } else {
+        return asmError( as, "expected an immediate but found \"%.*s\"", token->length, token->text );
+    }
+    *immediate = (uint32_t) token->value & 0xffff;
+    return true;
+}
+
+static bool assembleInstruction( Assembler * as, Token * op ) {
+    const Opcode * opcode = NULL;
+    uint32_t       s = 0, t = 0, d = 0, immediate = 0;
+    Token          token;
+    int            idx;
+
+    if( op->kind == TOKEN_DOTWORD ) {
+        nextToken( as, &token );
+        if( token.kind == TOKEN_ID ) {
+            if( ! addFixup( as, FIXUP_WORD, &token ) ) return false;
+        } else if( token.kind == TOKEN_INT ) {
+            if( token.value < -2147483648LL || token.value > 4294967295LL ) return asmError( as, ".word %.*s out of range", token.length, token.text );
+            immediate = (uint32_t) token.value;
+        } else if( token.kind == TOKEN_HEXINT ) {
+            if( token.value > 0xffffffffLL ) return asmError( as, ".word %.*s out of range", token.length, token.text );
+            immediate = (uint32_t) token.value;
+        } else {
+            return asmError( as, "expected an integer or label after .word but found \"%.*s\"", token.length, token.text );
+        }
+        return appendWord( as, immediate );
+    }
+
+    for( idx = 0; idx < NUM_OPCODES; idx++ ) {
+        if( (int) strlen( opcodes[idx].name ) == op->length && ! strncmp( opcodes[idx].name, op->text, op->length ) ) {
+            opcode = &opcodes[idx];
+            break;
+        }
+    }
+    if( opcode == NULL ) return asmError( as, "unknown instruction %.*s", op->length, op->text );
+
+    switch( opcode->format ) {
+        case FORMAT_DST:
+            if( ! registerOperand( as, &d, TOKEN_COMMA ) || ! registerOperand( as, &s, TOKEN_COMMA ) || ! registerOperand( as, &t, TOKEN_END ) ) return false;
+            break;
+        case FORMAT_ST:
+            if( ! registerOperand( as, &s, TOKEN_COMMA ) || ! registerOperand( as, &t, TOKEN_END ) ) return false;
+            break;
+        case FORMAT_D:
+            if( ! registerOperand( as, &d, TOKEN_END ) ) return false;
+            break;
+        case FORMAT_S:
+            if( ! registerOperand( as, &s, TOKEN_END ) ) return false;
+            break;
+        case FORMAT_MEMORY:
+            if( ! registerOperand( as, &t, TOKEN_COMMA ) ) return false;
+            nextToken( as, &token );
+            if( ! immediateOperand( as, &token, &immediate ) ) return false;
+            if( ! expect( as, TOKEN_LPAREN, &token, "'('" ) || ! registerOperand( as, &s, TOKEN_RPAREN ) ) return false;
+            break;
+        case FORMAT_BRANCH:
+            if( ! registerOperand( as, &s, TOKEN_COMMA ) || ! registerOperand( as, &t, TOKEN_COMMA ) ) return false;
+            nextToken( as, &token );
+            if( token.kind == TOKEN_ID ) {
+                if( ! addFixup( as, FIXUP_BRANCH, &token ) ) return false;
+            } else if( ! immediateOperand( as, &token, &immediate ) ) {
+                return false;
+            }
+            break;
+    }
+    return appendWord( as, opcode->bits | s << 21 | t << 16 | d << 11 | immediate );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// The assembler.
+//
+// -----------------------------------------------------------------------------------------------------
+
+static bool assembleLine( Assembler * as ) {
+    Token token;
+
+    nextToken( as, &token );
+    while( token.kind == TOKEN_LABEL ) {
+        if( ! defineLabel( as, &token, 4 * (uint32_t) as->program->nWords ) ) return false;
+        nextToken( as, &token );
+    }
+    if( token.kind == TOKEN_END ) return true;
+    if( token.kind != TOKEN_ID && token.kind != TOKEN_DOTWORD ) {
+        return asmError( as, "expected an instruction but found \"%.*s\"", token.length, token.text );
+    }
+    if( ! assembleInstruction( as, &token ) ) return false;
+
+    nextToken( as, &token );
+    if( token.kind != TOKEN_END ) return asmError( as, "unexpected \"%.*s\" at end of line", token.length, token.text );
+    return true;
+}
+
+bool mipsAssemble( const char * text, size_t length, MipsAssembly * program ) {
+    Assembler    as;
+    const char * end = text + length;
+    bool         ok  = true;
+
+    program->nWords   = 0;
+    program->capacity = 1024;
+    program->words    = malloc( program->capacity * sizeof(uint32_t) );
+    program->error[0] = '\0';
+
+    memset( &as, 0, sizeof(as) );
+    as.program       = program;
+    as.labelCapacity = 256;
+    as.labels        = calloc( as.labelCapacity, sizeof(Label) );
+    as.fixupCapacity = 256;
+    as.fixups        = malloc( as.fixupCapacity * sizeof(Fixup) );
+    if( program->words == NULL || as.labels == NULL || as.fixups == NULL ) ok = asmError( &as, "out of memory" );
+
+    as.pos = text;
+    while( ok && as.pos < end ) {
+        const char * newline = memchr( as.pos, '\n', end - as.pos );
+        as.lineEnd = newline != NULL ? newline : end;
+        as.line++;
+        ok = assembleLine( &as );
+        as.pos = as.lineEnd + 1;
+    }
+    if( ok ) ok = resolveFixups( &as );
+    if( ! ok ) program->nWords = 0;
+
+    free( as.labels );
+    free( as.fixups );
+    return ok;
+}
+
+void freeMipsAssembly( MipsAssembly * program ) {
+    free( program->words );
+    program->words    = NULL;
+    program->nWords   = 0;
+    program->capacity = 0;
+}
+
+bool mipsWriteProgram( FILE * out, const uint32_t * words, size_t nWords ) {
+    unsigned char buffer[4096];
+    size_t        length = 0, idx;
+
+    for( idx = 0; idx < nWords; idx++ ) {
+        buffer[length++] = words[idx] >> 24;
+        buffer[length++] = words[idx] >> 16;
+        buffer[length++] = words[idx] >>  8;
+        buffer[length++] = words[idx];
+        if( length == sizeof(buffer) || idx + 1 == nWords ) {
+            if( fwrite( buffer, 1, length, out ) != length ) return false;
+            length = 0;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+/*
+ * An assembler for the CS241 subset of MIPS assembly language - a native stand-in for java cs241.binasm
+ * that can be linked into other programs (wlgen --mips uses it to emit machine code directly).
+ *
+ * The language: one instruction per line, optionally preceded by any number of labels ("name:") and
+ * followed by a comment starting with ';'. The instructions are
+ *
+ *     .word i            i a decimal or hex (0x...) integer, or a label
+ *     add, sub, slt, sltu              $d, $s, $t
+ *     mult, multu, div, divu           $s, $t
+ *     mfhi, mflo, lis                  $d
+ *     lw, sw                           $t, i($s)
+ *     beq, bne                         $s, $t, i        i an integer or a label
+ *     jr, jalr                         $s
+ *
+ * A label used as a branch target is replaced by the (word) offset to it from the following instruction;
+ * anywhere else it stands for its address. The program is assembled at address 0.
+ *
+ * Typical use:
+ *
+ *     MipsAssembly program;
+ *     if( mipsAssemble( text, length, &program ) ) mipsWriteProgram( stdout, program.words, program.nWords );
+ *     else fprintf( stderr, "%s\n", program.error );
+ *     freeMipsAssembly( &program );
+ */
+
+#ifndef MIPSASM_H
+#define MIPSASM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct MipsAssembly {
+    uint32_t   * words;                  // The machine code, as host order words.
+    size_t       nWords;
+    size_t       capacity;
+    char         error[256];             // Why assembly failed - "ERROR: line n: ...".
+} MipsAssembly;
+
+// Assemble the length bytes of text (which needn't be '\0' terminated) into program. Returns false, with no
+// words assembled and program->error set, if text isn't a valid program. Either way freeMipsAssembly(...)
+// should be called once program is no longer needed.
+bool mipsAssemble(       const char * text, size_t length, MipsAssembly * program );
+void freeMipsAssembly(   MipsAssembly * program );
+
+// Write nWords words to out as binasm does - four bytes each, most significant first. Returns false if the
+// write fails.
+bool mipsWriteProgram(   FILE * out, const uint32_t * words, size_t nWords );
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * An emulator for the CS241 subset of the MIPS instruction set. See mipsemu.h.
+ *
+ * The subset, by encoding (s, t, d are register numbers, i a signed 16 bit immediate):
+ *
+ *     add  $d,$s,$t    000000 sssss ttttt ddddd 00000 100000        lw   $t,i($s)  100011 sssss ttttt iiii...
+ *     sub  $d,$s,$t    000000 sssss ttttt ddddd 00000 100010        sw   $t,i($s)  101011 sssss ttttt iiii...
+ *     slt  $d,$s,$t    000000 sssss ttttt ddddd 00000 101010        beq  $s,$t,i   000100 sssss ttttt iiii...
+ *     sltu $d,$s,$t    000000 sssss ttttt ddddd 00000 101011        bne  $s,$t,i   000101 sssss ttttt iiii...
+ *     mult $s,$t       000000 sssss ttttt 00000 00000 011000        mfhi $d        000000 00000 00000 ddddd 00000 010000
+ *     multu $s,$t      000000 sssss ttttt 00000 00000 011001        mflo $d        000000 00000 00000 ddddd 00000 010010
+ *     div  $s,$t       000000 sssss ttttt 00000 00000 011010        lis  $d        000000 00000 00000 ddddd 00000 010100
+ *     divu $s,$t       000000 sssss ttttt 00000 00000 011011        jr   $s        000000 sssss 00000 00000 00000 001000
+ *                                                                   jalr $s        000000 sssss 00000 00000 00000 001001
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mipsemu.h"
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Creating and loading a machine.
+//
+// -----------------------------------------------------------------------------------------------------
+
+MipsMachine * newMipsMachine( uint32_t memorySize ) {
+    MipsMachine * machine = calloc( 1, sizeof(MipsMachine) );
+    if( machine == NULL ) return NULL;
+    machine->memorySize     = memorySize & ~3u;
+    machine->dirtyLow       = UINT32_MAX;
+    machine->memory         = calloc( machine->memorySize / 4, sizeof(uint32_t) );
+    machine->outputCapacity = 256;
+    machine->output         = malloc( machine->outputCapacity );
+    if( machine->memory == NULL || machine->output == NULL ) {
+        freeMipsMachine( machine );
+        return NULL;
+    }
+    machine->output[0] = '\0';
+    return machine;
+}
+
+void freeMipsMachine( MipsMachine * machine ) {
+    if( machine == NULL ) return;
+    free( machine->memory  );
+    free( machine->program );
+    free( machine->output  );
+    free( machine );
+}
+
+bool mipsLoad( MipsMachine * machine, const uint32_t * words, size_t nWords ) {
+    if( nWords > machine->memorySize / 4 ) return false;
+    uint32_t * program = malloc( nWords * sizeof(uint32_t) + 1 );     // +1 so that an empty program isn't a NULL.
+    if( program == NULL ) return false;
+    memcpy( program, words, nWords * sizeof(uint32_t) );
+    // Memory is all 0's apart from the old program and whatever the last run dirtied (which mipsReset clears),
+    // so loading one program after another - as wlfuzz does thousands of times a second - doesn't have to
+    // clear all of memory.
+    memset( machine->memory, 0, machine->programSize );
+    free( machine->program );
+    machine->program     = program;
+    machine->programSize = nWords * 4;
+    mipsReset( machine, NULL, 0 );
+    return true;
+}
+
+uint32_t * mipsReadProgram( const char * path, size_t * nWords ) {
+    FILE          * in       = fopen( path, "rb" );
+    size_t          capacity = 1024, count = 0;
+    uint32_t      * words    = malloc( capacity * sizeof(uint32_t) );
+    unsigned char   bytes[4];
+    size_t          got;
+
+    if( in == NULL || words == NULL ) {
+        if( in != NULL ) fclose( in );
+        free( words );
+        return NULL;
+    }
+    while( (got = fread( bytes, 1, 4, in )) == 4 ) {
+        if( count == capacity ) {
+            uint32_t * grown = realloc( words, 2 * capacity * sizeof(uint32_t) );
+            if( grown == NULL ) break;
+            words     = grown;
+            capacity *= 2;
+        }
+        words[count++] = (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+    }
+    if( got != 0 || ! feof( in ) ) {                    // A partial word at the end, a read error, or out of memory.
+        if( got != 0 ) errno = EINVAL;
+        else if( ! ferror( in ) ) errno = ENOMEM;
+        fclose( in );
+        free( words );
+        return NULL;
+    }
+    fclose( in );
+    *nWords = count;
+    return words;
+}
+
+void mipsReset( MipsMachine * machine, const char * input, size_t inputLength ) {
+    if( machine->dirtyLow < machine->dirtyHigh ) {
+        memset( (char *) machine->memory + machine->dirtyLow, 0, machine->dirtyHigh - machine->dirtyLow );
+    }
+    machine->dirtyLow  = UINT32_MAX;
+    machine->dirtyHigh = 0;
+    memcpy( machine->memory, machine->program, machine->programSize );
+
+    memset( machine->reg, 0, sizeof(machine->reg) );
+    machine->reg[30]      = machine->memorySize;
+    machine->reg[31]      = MIPS_RETURN_ADDRESS;
+    machine->hi           = 0;
+    machine->lo           = 0;
+    machine->pc           = 0;
+    machine->input        = input;
+    machine->inputLength  = inputLength;
+    machine->inputPos     = 0;
+    machine->outputLength = 0;
+    machine->output[0]    = '\0';
+    machine->instructions = 0;
+    machine->loads        = 0;
+    machine->stores       = 0;
+    machine->branches     = 0;
+    machine->status       = MIPS_RUNNING;
+    machine->error[0]     = '\0';
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Execution.
+//
+// -----------------------------------------------------------------------------------------------------
+
+static MipsStatus fail( MipsMachine * machine, const char * what, uint32_t value ) {
+    snprintf( machine->error, sizeof(machine->error), "%s 0x%08x at pc 0x%08x", what, value, machine->pc - 4 );
+    return machine->status = MIPS_ERROR;
+}
+
+static bool putOutput( MipsMachine * machine, char byte ) {
+    if( machine->outputLength + 1 == machine->outputCapacity ) {
+        char * grown = realloc( machine->output, 2 * machine->outputCapacity );
+        if( grown == NULL ) return false;
+        machine->output          = grown;
+        machine->outputCapacity *= 2;
+    }
+    machine->output[machine->outputLength++] = byte;
+    machine->output[machine->outputLength]   = '\0';
+    return true;
+}
+
+MipsStatus mipsRun( MipsMachine * machine, uint64_t maxSteps ) {
+
+    uint32_t * reg = machine->reg;
+
+    while( machine->status == MIPS_RUNNING ) {
+
+        if( machine->pc == MIPS_RETURN_ADDRESS ) return machine->status = MIPS_HALTED;
+        if( maxSteps != MIPS_NO_STEP_LIMIT && machine->instructions == maxSteps ) return machine->status = MIPS_STEP_LIMIT;
+        if( machine->pc >= machine->memorySize || machine->pc % 4 != 0 ) {
+            machine->pc += 4;                                           // So that fail(...) reports the right pc.
+            return fail( machine, "jump to invalid address", machine->pc - 4 );
+        }
+
+        uint32_t word = machine->memory[machine->pc / 4];
+        uint32_t s    = word >> 21 & 31;
+        uint32_t t    = word >> 16 & 31;
+        uint32_t d    = word >> 11 & 31;
+        int32_t  imm  = (int16_t) (word & 0xffff);
+        machine->pc += 4;
+        machine->instructions++;
+
+        switch( word >> 26 ) {
+
+            case 0x00:
+                if( (word & 0x7c0) != 0 ) return fail( machine, "invalid instruction", word );
+                switch( word & 0x3f ) {
+                    case 0x20: reg[d] = reg[s] + reg[t];                                     break;   // add
+                    case 0x22: reg[d] = reg[s] - reg[t];                                     break;   // sub
+                    case 0x2a: reg[d] = (int32_t) reg[s] < (int32_t) reg[t];                 break;   // slt
+                    case 0x2b: reg[d] = reg[s] < reg[t];                                     break;   // sltu
+                    case 0x18: {                                                                      // mult
+                        int64_t product = (int64_t) (int32_t) reg[s] * (int32_t) reg[t];
+                        machine->hi = (uint32_t) ((uint64_t) product >> 32);
+                        machine->lo = (uint32_t) product;
+                        break;
+                    }
+                    case 0x19: {                                                                      // multu
+                        uint64_t product = (uint64_t) reg[s] * reg[t];
+                        machine->hi = (uint32_t) (product >> 32);
+                        machine->lo = (uint32_t) product;
+                        break;
+                    }
+                    case 0x1a:                                                                        // div
+                        if( reg[t] == 0 ) return fail( machine, "division by zero in", word );
+                        if( reg[s] == 0x80000000u && reg[t] == 0xffffffffu ) {                        // Overflows; as the hardware does.
+                            machine->lo = 0x80000000u;
+                            machine->hi = 0;
+                        } else {
+                            machine->lo = (uint32_t) ((int32_t) reg[s] / (int32_t) reg[t]);
+                            machine->hi = (uint32_t) ((int32_t) reg[s] % (int32_t) reg[t]);
+                        }
+                        break;
+                    case 0x1b:                                                                        // divu
+                        if( reg[t] == 0 ) return fail( machine, "division by zero in", word );
+                        machine->lo = reg[s] / reg[t];
+                        machine->hi = reg[s] % reg[t];
+                        break;
+                    case 0x10: reg[d] = machine->hi;                                         break;   // mfhi
+                    case 0x12: reg[d] = machine->lo;                                         break;   // mflo
+                    case 0x14:                                                                        // lis
+                        if( machine->pc >= machine->memorySize ) return fail( machine, "lis at end of memory", word );
+                        reg[d] = machine->memory[machine->pc / 4];
+                        machine->pc += 4;
+                        break;
+                    case 0x08: machine->pc = reg[s];                                         break;   // jr
+                    case 0x09: {                                                                      // jalr
+                        uint32_t target = reg[s];
+                        reg[31]     = machine->pc;
+                        machine->pc = target;
+                        break;
+                    }
+                    default:
+                        return fail( machine, "invalid instruction", word );
+                }
+                break;
+
+            case 0x23: {                                                                              // lw
+                uint32_t address = reg[s] + (uint32_t) imm;
+                machine->loads++;
+                if( address == MIPS_INPUT_ADDRESS ) {
+                    reg[t] = machine->inputPos < machine->inputLength
+                           ? (unsigned char) machine->input[machine->inputPos++]
+                           : 0xffffffffu;
+                } else if( address % 4 != 0 || address >= machine->memorySize ) {
+                    return fail( machine, "invalid load from", address );
+                } else {
+                    reg[t] = machine->memory[address / 4];
+                }
+                break;
+            }
+
+            case 0x2b: {                                                                              // sw
+                uint32_t address = reg[s] + (uint32_t) imm;
+                machine->stores++;
+                if( address == MIPS_OUTPUT_ADDRESS ) {
+                    if( ! putOutput( machine, (char) (reg[t] & 0xff) ) ) return fail( machine, "out of memory for output at", address );
+                } else if( address % 4 != 0 || address >= machine->memorySize ) {
+                    return fail( machine, "invalid store to", address );
+                } else {
+                    machine->memory[address / 4] = reg[t];
+                    if( address     < machine->dirtyLow  ) machine->dirtyLow  = address;
+                    if( address + 4 > machine->dirtyHigh ) machine->dirtyHigh = address + 4;
+                }
+                break;
+            }
+
+            case 0x04:                                                                                // beq
+                machine->branches++;
+                if( reg[s] == reg[t] ) machine->pc += (uint32_t) imm * 4;
+                break;
+            case 0x05:                                                                                // bne
+                machine->branches++;
+                if( reg[s] != reg[t] ) machine->pc += (uint32_t) imm * 4;
+                break;
+
+            default:
+                return fail( machine, "invalid instruction", word );
+        }
+
+        reg[0] = 0;
+    }
+    return machine->status;
+}
+
+MipsStatus mipsRunTwoInts( MipsMachine * machine, int32_t a, int32_t b, uint64_t maxSteps ) {
+    mipsReset( machine, NULL, 0 );
+    machine->reg[1] = (uint32_t) a;
+    machine->reg[2] = (uint32_t) b;
+    return mipsRun( machine, maxSteps );
+}
@@ -0,0 +1,83 @@
+/*
+ * An emulator for the CS241 subset of the MIPS instruction set - a native stand-in for java mips.twoints
+ * that can be linked into other programs.
+ *
+ * The machine follows the CS241 conventions: the program is loaded at address 0, $30 starts at the top of
+ * memory, and $31 holds a return address that doesn't belong to the program, so the program halts when it
+ * executes jr $31. A word stored to 0xffff000c writes its low order byte to the program's output; a word
+ * loaded from 0xffff0004 reads the next byte of the program's input (-1 at end of input).
+ *
+ * Typical use:
+ *
+ *     MipsMachine * machine = newMipsMachine( MIPS_MEMORY_SIZE );
+ *     mipsLoad( machine, words, nWords );
+ *     mipsRunTwoInts( machine, 4, 5, MIPS_NO_STEP_LIMIT );
+ *     ... machine->reg[3], machine->output ...
+ *     freeMipsMachine( machine );
+ */
+
+#ifndef MIPSEMU_H
+#define MIPSEMU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIPS_MEMORY_SIZE     0x01000000     // Bytes of memory, and so the initial value of $30.
+#define MIPS_RETURN_ADDRESS  0x8123456c     // The initial value of $31; jumping to it halts the machine.
+#define MIPS_INPUT_ADDRESS   0xffff0004     // lw from here reads a byte of input.
+#define MIPS_OUTPUT_ADDRESS  0xffff000c     // sw to here writes a byte of output.
+#define MIPS_NO_STEP_LIMIT   0
+
+typedef enum {
+    MIPS_RUNNING,                           // Still executing.
+    MIPS_HALTED,                            // Returned to MIPS_RETURN_ADDRESS; reg[3] is the result.
+    MIPS_ERROR,                             // Stopped by a bad instruction or memory access; see error.
+    MIPS_STEP_LIMIT                         // Stopped after executing the maximum number of instructions.
+} MipsStatus;
+
+typedef struct MipsMachine {
+    uint32_t     reg[32];                   // reg[0] is reset to 0 after every instruction.
+    uint32_t     hi, lo, pc;
+    uint32_t   * memory;                    // memorySize bytes, held as (host order) words.
+    uint32_t     memorySize;
+    uint32_t     programSize;               // Bytes of memory occupied by the loaded program.
+    uint32_t   * program;                   // A copy of the program, used to reset memory between runs.
+    uint32_t     dirtyLow, dirtyHigh;       // Memory written since the last reset lies in [dirtyLow,dirtyHigh), so
+                                            // a reset only has to clear what the previous run touched.
+
+    const char * input;                     // The bytes read from MIPS_INPUT_ADDRESS, and how many have been read.
+    size_t       inputLength, inputPos;
+    char       * output;                    // The bytes written to MIPS_OUTPUT_ADDRESS; always '\0' terminated.
+    size_t       outputLength, outputCapacity;
+
+    uint64_t     instructions;              // Instructions executed by the current run.
+    uint64_t     loads, stores;             // Of those, how many were lw's and sw's ...
+    uint64_t     branches;                  // ... and how many were beq's and bne's.
+
+    MipsStatus   status;
+    char         error[128];                // Why the machine stopped when status == MIPS_ERROR.
+} MipsMachine;
+
+MipsMachine * newMipsMachine(  uint32_t memorySize );
+void          freeMipsMachine( MipsMachine * machine );
+
+// Load a program given as host order words (see mipsReadProgram). Returns false if it doesn't fit in memory.
+bool          mipsLoad(        MipsMachine * machine, const uint32_t * words, size_t nWords );
+
+// Read a *.mips file - big endian words as written by binasm - into a malloc'd array. Returns NULL on
+// failure, leaving errno set.
+uint32_t    * mipsReadProgram( const char * path, size_t * nWords );
+
+// Reset the machine to its initial state - registers cleared, memory holding just the program, no output
+// yet - with the given input. The input isn't copied; it has to outlive the run.
+void          mipsReset(       MipsMachine * machine, const char * input, size_t inputLength );
+
+// Execute instructions until the machine halts, fails, or (unless maxSteps is MIPS_NO_STEP_LIMIT) has
+// executed maxSteps instructions. Returns the resulting status.
+MipsStatus    mipsRun(         MipsMachine * machine, uint64_t maxSteps );
+
+// What java mips.twoints does: reset the machine with no input, set $1 = a and $2 = b, and run.
+MipsStatus    mipsRunTwoInts(  MipsMachine * machine, int32_t a, int32_t b, uint64_t maxSteps );
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * A native replacement for java mips.twoints, built on the emulator in mipsemu.c.
+ *
+ *     twoints prog.mips
+ *
+ *         Behaves like java mips.twoints: prompts for and reads $1 and $2 from stdin, runs the program with
+ *         its output going to stdout, then dumps the registers to stderr.
+ *
+ *     twoints --trials [--max-steps N] prog.mips
+ *
+ *         Runs the program once for each line of stdin, which holds the trial's values of $1 and $2
+ *         separated by whitespace, and writes one line of JSON per trial to stdout:
+ *
+ *             {"trial":1,"a":4,"b":5,"status":"halted","return_val":4,"output":"","instructions":12,"loads":3,"stores":5,"branches":0}
+ *
+ *         status is one of "halted", "error" (with the reason in "error") or "step_limit"; return_val is
+ *         $3 as a signed integer. instructions counts every instruction executed, and loads, stores and
+ *         branches count the lw's, sw's and beq's and bne's among them. A trial that runs more than N
+ *         instructions (default 100000000, 0 for no limit) is stopped. Exits with status 1 if any trial
+ *         didn't halt.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "mipsemu.h"
+
+#define DEFAULT_MAX_STEPS 100000000
+
+static const char * statusNames[] = { "running", "halted", "error", "step_limit" };
+
+void usage( char * program ) {
+    fprintf( stderr, "usage: %s prog.mips\n", program );
+    fprintf( stderr, "       %s --trials [--max-steps N] prog.mips < trials\n", program );
+    exit(1);
+}
+
+// Write text to out as the body of a JSON string.
+void printJsonString( FILE * out, const char * text, size_t length ) {
+    size_t idx;
+    fputc( '"', out );
+    for( idx = 0; idx < length; idx++ ) {
+        unsigned char c = text[idx];
+        switch( c ) {
+            case '"':  fputs( "\\\"", out ); break;
+            case '\\': fputs( "\\\\", out ); break;
+            case '\n': fputs( "\\n",  out ); break;
+            case '\r': fputs( "\\r",  out ); break;
+            case '\t': fputs( "\\t",  out ); break;
+            default:
+                if( c < 0x20 || c >= 0x7f ) fprintf( out, "\\u%04x", c );
+                else                        fputc( c, out );
+        }
+    }
+    fputc( '"', out );
+}
+
+// Parse a trial's inputs; both have to fit in 32 bits, signed or unsigned.
+bool parseTrial( char * line, int32_t * a, int32_t * b ) {
+    char      * end;
+    long long   values[2];
+    int         idx;
+    for( idx = 0; idx < 2; idx++ ) {
+        errno = 0;
+        values[idx] = strtoll( line, &end, 0 );
+        if( end == line || errno != 0 || values[idx] < INT32_MIN || values[idx] > UINT32_MAX ) return false;
+        line = end;
+    }
+    while( *line == ' ' || *line == '\t' || *line == '\r' || *line == '\n' ) line++;
+    if( *line != '\0' ) return false;
+    *a = (int32_t) (uint32_t) values[0];
+    *b = (int32_t) (uint32_t) values[1];
+    return true;
+}
+
+int runTrials( MipsMachine * machine, uint64_t maxSteps ) {
+    char    * line    = NULL;
+    size_t    size    = 0;
+    int       nTrials = 0;
+    bool      allHalted = true;
+    int32_t   a, b;
+
+    while( getline( &line, &size, stdin ) >= 0 ) {
+        if( strspn( line, " \t\r\n" ) == strlen( line ) ) continue;                        // Skip blank lines.
+        nTrials++;
+        if( ! parseTrial( line, &a, &b ) ) {
+            printf( "{\"trial\":%d,\"status\":\"error\",\"error\":\"expected two integers\"}\n", nTrials );
+            allHalted = false;
+            continue;
+        }
+        MipsStatus status = mipsRunTwoInts( machine, a, b, maxSteps );
+        printf( "{\"trial\":%d,\"a\":%" PRId32 ",\"b\":%" PRId32 ",\"status\":\"%s\"", nTrials, a, b, statusNames[status] );
+        if( status == MIPS_ERROR ) {
+            printf( ",\"error\":" );
+            printJsonString( stdout, machine->error, strlen( machine->error ) );
+        }
+        printf( ",\"return_val\":%" PRId32 ",\"output\":", (int32_t) machine->reg[3] );
+        printJsonString( stdout, machine->output, machine->outputLength );
+        printf( ",\"instructions\":%" PRIu64 ",\"loads\":%" PRIu64 ",\"stores\":%" PRIu64 ",\"branches\":%" PRIu64 "}\n",
+                machine->instructions, machine->loads, machine->stores, machine->branches );
+        if( status != MIPS_HALTED ) allHalted = false;
+    }
+    free( line );
+    return allHalted ? 0 : 1;
+}
+
+// Mimic java mips.twoints.
+int runInteractive( MipsMachine * machine, uint64_t maxSteps ) {
+    long long a, b;
+    int       idx;
+
+    fprintf( stderr, "Enter value for register 1: " );
+    if( scanf( "%lld", &a ) != 1 ) { fprintf( stderr, "\nERROR: expected an integer\n" ); return 1; }
+    fprintf( stderr, "Enter value for register 2: " );
+    if( scanf( "%lld", &b ) != 1 ) { fprintf( stderr, "\nERROR: expected an integer\n" ); return 1; }
+    fprintf( stderr, "Running MIPS program.\n" );
+
+    MipsStatus status = mipsRunTwoInts( machine, (int32_t) a, (int32_t) b, maxSteps );
+    fwrite( machine->output, 1, machine->outputLength, stdout );
+    fflush( stdout );
+
+    if( status == MIPS_HALTED ) fprintf( stderr, "MIPS program completed normally.\n" );
+    else if( status == MIPS_ERROR ) fprintf( stderr, "ERROR: %s\n", machine->error );
+    else fprintf( stderr, "ERROR: step limit of %" PRIu64 " instructions reached\n", maxSteps );
+    for( idx = 1; idx < 32; idx++ ) {
+        fprintf( stderr, "$%02d = 0x%08" PRIx32 "%s", idx, machine->reg[idx], idx % 4 == 0 || idx == 31 ? "\n" : "   " );
+    }
+    return status == MIPS_HALTED ? 0 : 1;
+}
+
+int main( int argc, char * argv[] ) {
+
+    bool       trials   = false;
+    uint64_t   maxSteps = MIPS_NO_STEP_LIMIT;
+    bool       maxStepsGiven = false;
+    int        argi;
+
+    for( argi = 1; argi < argc && argv[argi][0] == '-'; argi++ ) {
+        if( ! strcmp( argv[argi], "--trials" ) ) {
+            trials = true;
+        } else if( ! strcmp( argv[argi], "--max-steps" ) && argi + 1 < argc ) {
+            maxSteps      = strtoull( argv[++argi], NULL, 10 );
+            maxStepsGiven = true;
+        } else {
+            usage( argv[0] );
+        }
+    }
+    if( argc - argi != 1 ) usage( argv[0] );
+    if( trials && ! maxStepsGiven ) maxSteps = DEFAULT_MAX_STEPS;
+
+    size_t     nWords;
+    uint32_t * words = mipsReadProgram( argv[argi], &nWords );
+    if( words == NULL ) {
+        fprintf( stderr, "ERROR: can't read %s: %s\n", argv[argi], strerror( errno ) );
+        return 1;
+    }
+    MipsMachine * machine = newMipsMachine( MIPS_MEMORY_SIZE );
+    if( machine == NULL || ! mipsLoad( machine, words, nWords ) ) {
+        fprintf( stderr, "ERROR: can't load %s\n", argv[argi] );
+        return 1;
+    }
+    free( words );
+
+    int status = trials ? runTrials( machine, maxSteps ) : runInteractive( machine, maxSteps );
+    freeMipsMachine( machine );
+    return status;
+}
@@ -0,0 +1,179 @@
+/*
+ * Benchmarks the three passes of wlgen on synthetic programs of increasing size.
+ *
+ *     wlbench [--shape statements|dcls|expr|nest] [--min NODES] [--max NODES] [--depth DEPTH] [--stack MB]
+ *
+ * For each shape (see wlsynth.c) and each size from --min (default 1000) to --max (default 10000000)
+ * nodes, going up by factors of 10, a program is generated into a temporary file and compiled, timing
+ * readParse(...), symbolsDeclaredIn(...) and generateCodeFor(...) separately; the generated code goes to
+ * /dev/null. Each line of the report gives a pass's throughput in nodes per second and the average time
+ * per node - which should stay roughly constant as the size grows, since every pass is meant to be linear
+ * in the size of the tree - together with the peak resident set size of the whole compilation.
+ *
+ * Each compilation runs in a child process of its own so that its peak RSS is its own. Passes two and three
+ * recurse once per level of nesting, so they run on a thread with a very large stack (see --stack), which
+ * lets the "expr" shape reach the largest sizes.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#define WLGEN_NO_MAIN
+#define WLSYNTH_NO_MAIN
+#include "wlgen.c"
+#include "wlsynth.c"
+
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_MIN_NODES     1000L
+#define DEFAULT_MAX_NODES     10000000L
+#define DEFAULT_STACK_MB      4096
+
+typedef struct BenchRun {
+    Shape    shape;
+    long     nodes;                         // Requested; the actual # is parse->nNodes.
+    int      depth;
+    int      fd;                            // The generated program.
+    double   seconds[3];                    // For each pass.
+    int      nNodes;
+    bool     compiled;
+} BenchRun;
+
+double now( void ) {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Compile run->fd, timing each pass. Runs on its own thread (see runOnBigStack).
+void * compileAndTime( void * arg ) {
+
+    BenchRun    * run = arg;
+    jmp_buf       recovery;
+    FILE        * sink  = fopen( "/dev/null", "w" );
+    double        start;
+
+    if( sink == NULL ) panicExit( "can't open /dev/null" );
+    errorRecovery = &recovery;
+    if( setjmp( recovery ) == 0 ) {
+        ParseTree   * parse   = newParseTree();
+        SymbolTable * symbols = newSymbolTable();
+        Emitter     * program = newEmitter( sink );
+
+        start = now();
+        readParse( parse, run->fd );
+        run->seconds[0] = now() - start;
+        run->nNodes     = parse->nNodes;
+
+        start = now();
+        symbolsDeclaredIn( parse, &parse->nodes[0], symbols );
+        run->seconds[1] = now() - start;
+
+        start = now();
+        generateCodeFor( parse, &parse->nodes[0], symbols, program );
+        flushEmitter( program );
+        run->seconds[2] = now() - start;
+
+        run->compiled = true;
+        // The process exits straight afterwards; nothing is freed, so that freeing isn't timed.
+    }
+    errorRecovery = NULL;
+    return NULL;
+}
+
+void runOnBigStack( BenchRun * run, size_t stackBytes ) {
+    pthread_attr_t attributes;
+    pthread_t      thread;
+    pthread_attr_init( &attributes );
+    if( pthread_attr_setstacksize( &attributes, stackBytes ) != 0
+        || pthread_create( &thread, &attributes, compileAndTime, run ) != 0 ) {
+        panicExit( "can't start the benchmark thread" );
+    }
+    pthread_join( thread, NULL );
+    pthread_attr_destroy( &attributes );
+}
+
+// Generate and compile one program in a child process, which prints one line of the report per pass.
+void benchmark( Shape shape, long nodes, int depth, size_t stackBytes ) {
+
+    pid_t child;
+    int   status;
+
+    fflush( stdout );
+    child = fork();
+    if( child < 0 ) panicExit( "fork failed" );
+    if( child == 0 ) {
+        BenchRun        run;
+        FILE          * program = tmpfile();
+        struct rusage   usage;
+        char          * passNames[3] = { "readParse", "symbolsDeclaredIn", "generateCodeFor" };
+        int             pass;
+
+        memset( &run, 0, sizeof(run) );
+        run.shape = shape;
+        run.nodes = nodes;
+        run.depth = depth;
+        if( program == NULL ) panicExit( "can't create a temporary file" );
+        synthesizeProgram( program, shape, nodes, depth );
+        if( fflush( program ) != 0 ) panicExit( "can't write the temporary file" );
+        run.fd = fileno( program );
+        lseek( run.fd, 0, SEEK_SET );
+
+        initGrammar();
+        runOnBigStack( &run, stackBytes );
+        getrusage( RUSAGE_SELF, &usage );
+
+        if( ! run.compiled ) {
+            printf( "%-10s %10ld  %s\n", shapeNames[shape], nodes, errorMessage );
+            exit(1);
+        }
+        for( pass = 0; pass < 3; pass++ ) {
+            double seconds = run.seconds[pass] > 0 ? run.seconds[pass] : 1e-9;
+            printf( "%-10s %10d  %-17s %9.4f s %12.0f nodes/s %8.1f ns/node %9.1f MB\n",
+                    shapeNames[shape], run.nNodes, passNames[pass], run.seconds[pass],
+                    run.nNodes / seconds, 1e9 * seconds / run.nNodes, usage.ru_maxrss / 1024.0 );
+        }
+        exit(0);
+    }
+    if( waitpid( child, &status, 0 ) < 0 || ! WIFEXITED( status ) ) {
+        printf( "%-10s %10ld  crashed\n", shapeNames[shape], nodes );
+    }
+}
+
+int main( int argc, char * argv[] ) {
+
+    Shape    only     = SHAPE_UNKNOWN;            // Every shape.
+    long     minNodes = DEFAULT_MIN_NODES;
+    long     maxNodes = DEFAULT_MAX_NODES;
+    int      depth    = DEFAULT_NEST_DEPTH;
+    long     stackMB  = DEFAULT_STACK_MB;
+    int      argi, shape;
+    long     nodes;
+    bool     valid    = true;
+
+    for( argi = 1; argi + 1 < argc; argi += 2 ) {
+        if( ! strcmp( argv[argi], "--shape" ) ) {
+            only  = shapeFor( argv[argi+1] );
+            valid = only != SHAPE_UNKNOWN;
+        } else if( ! strcmp( argv[argi], "--min"   ) ) minNodes = atol( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--max"   ) ) maxNodes = atol( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--depth" ) ) depth    = atoi( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--stack" ) ) stackMB  = atol( argv[argi+1] );
+        else break;
+    }
+    if( ! valid || argi != argc || minNodes <= 0 || maxNodes < minNodes || depth <= 0 || stackMB <= 0 ) {
+        fprintf( stderr, "usage: %s [--shape statements|dcls|expr|nest] [--min NODES] [--max NODES] [--depth DEPTH] [--stack MB]\n", argv[0] );
+        return 1;
+    }
+
+    printf( "%-10s %10s  %-17s %11s %20s %16s %12s\n", "shape", "nodes", "pass", "time", "throughput", "per node", "peak RSS" );
+    for( shape = 0; shape < NUM_SHAPES; shape++ ) {
+        if( only != SHAPE_UNKNOWN && shape != only ) continue;
+        for( nodes = minNodes; nodes <= maxNodes; nodes *= 10 ) {
+            benchmark( (Shape) shape, nodes, depth, (size_t) stackMB << 20 );
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,1133 @@
+/*
+ * Differential fuzzing for wlgen: compiles random WL programs and checks what the code does against an
+ * interpreter.
+ *
+ *     wlfuzz [--jobs N] [--seconds S] [--programs N] [--seed S] [--max-failures N] [--out DIR]
+ *
+ * Each program is generated at random from the WL grammar - declarations, assignments (some through
+ * parenthesized lvalues), if's, counted while loops, println's and expressions mixing every operator - so
+ * that it is always valid WL and always terminates. wlgen compiles it to machine code, once without and once
+ * with -O, without leaving the process (this file #include's wlgen.c, like wlbench.c), and the code runs on
+ * the emulator in mipsemu.c for several (a, b) inputs, including the edge cases 0, -1, INT_MIN and INT_MAX.
+ * The return value and output of each run are checked against those of an interpreter that evaluates the
+ * parse tree wlgen's own pass one builds for the program. Runs that divide by zero have no defined result,
+ * so they are skipped rather than compared.
+ *
+ * The programs are spread over --jobs (default one per core) worker processes, which report their progress
+ * to the main process through shared memory. Program n is generated from --seed (default the time) and n
+ * alone, so whatever the number of jobs, a failure can be reproduced with the same seed.
+ *
+ * When wlgen rejects a program, crashes on one, or compiles one into code that disagrees with the
+ * interpreter, the program is reduced - by repeatedly deleting statements and declarations and replacing
+ * statements and expressions by their parts, for as long as wlgen still gets the reduced program wrong - and
+ * the result is printed and saved as a test case, DIR/fuzz_XXXXXXXX.yaml (DIR defaults to testcases/fuzz),
+ * that rake runs along with the others. Fuzzing stops after --seconds (default 10; 0 for no limit), after
+ * --programs programs, or after --max-failures (default 1) failures, whichever comes first. Exits with status
+ * 1 if there were any failures.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#define WLGEN_NO_MAIN
+#include "wlgen.c"
+
+#include "mipsemu.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SECONDS         10
+#define DEFAULT_OUT_DIR         "testcases/fuzz"
+#define MAX_JOBS                256
+#define MAX_SOURCE              (64 * 1024)         // Generated programs are a few KB at most.
+#define MAX_VARIABLES           16                  // Including wain's parameters.
+#define MAX_TRIALS              5
+#define MAX_INTERPRETER_STEPS   100000L             // Statements and loop tests; the generated loops need far fewer.
+#define MAX_EMULATOR_STEPS      100000000ULL
+#define REDUCTION_TIMEOUT       10                  // Seconds wlgen may spend on a candidate during reduction.
+#define REPORT_INTERVAL         5                   // Seconds between progress reports.
+#define WHY_SIZE                (ERROR_MESSAGE_SIZE + 64)   // Room for an errorMessage and what wlgen was doing.
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// Helpers.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// A growable string.
+typedef struct Text {
+    char   * chars;                         // Always '\0' terminated.
+    size_t   length;
+    size_t   capacity;
+} Text;
+
+void reserveText( Text * text, size_t bytes ) {
+    if( text->length + bytes + 1 > text->capacity ) {
+        size_t capacity = text->capacity ? 2 * text->capacity : 1024;
+        while( capacity < text->length + bytes + 1 ) capacity *= 2;
+        text->chars = realloc( text->chars, capacity );
+        if( text->chars == NULL ) panicExit( "out of memory" );
+        text->capacity = capacity;
+    }
+}
+
+void appendBytes( Text * text, const char * bytes, size_t length ) {
+    reserveText( text, length );
+    memcpy( text->chars + text->length, bytes, length );
+    text->length += length;
+    text->chars[text->length] = '\0';
+}
+
+void append( Text * text, const char * format, ... ) {
+    va_list args;
+    int     length;
+
+    va_start( args, format );
+    length = vsnprintf( NULL, 0, format, args );
+    va_end( args );
+    reserveText( text, length );
+    va_start( args, format );
+    vsnprintf( text->chars + text->length, length + 1, format, args );
+    va_end( args );
+    text->length += length;
+}
+
+void clearText( Text * text ) {
+    text->length = 0;
+    reserveText( text, 0 );
+    text->chars[0] = '\0';
+}
+
+void copyText( Text * to, Text * from ) {
+    clearText( to );
+    appendBytes( to, from->chars, from->length );
+}
+
+// The FNV-1a hash of text, which names the test case saved for it.
+uint32_t hashOf( const char * text, size_t length ) {
+    uint32_t hash = 2166136261u;
+    size_t   idx;
+    for( idx = 0; idx < length; idx++ ) hash = (hash ^ (unsigned char) text[idx]) * 16777619u;
+    return hash;
+}
+
+// splitmix64: a fast generator whose every state - even one made from a small seed - gives good output.
+uint64_t nextRandom( uint64_t * state ) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, n).
+int randomBelow( uint64_t * state, int n ) {
+    return (int) (nextRandom( state ) % (uint64_t) n);
+}
+
+bool chance( uint64_t * state, int percent ) {
+    return randomBelow( state, 100 ) < percent;
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// Generating programs.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// The programs are written straight out as source, following the grammar: genExpr(...) writes an expr,
+// genTerm(...) a term and so on. Every variable is initialized before it is used, and the only loops count a
+// variable that nothing else in the loop assigns to up (or down) to a small bound, so every program
+// terminates. The names of variables are built from prefixes of the keywords, to exercise the scanner.
+
+typedef struct Generator {
+    uint64_t   random;
+    Text     * out;
+    int        nVariables;
+    char       names[MAX_VARIABLES][16];
+    bool       locked[MAX_VARIABLES];       // Counting a loop that's being generated, so not to be assigned to.
+    int        indent;
+} Generator;
+
+char * nameStems[] = { "v", "x", "i", "in", "iff", "el", "elsex", "whil", "ret", "returned", "printl", "wainx", "n" };
+
+char * relops[] = { "==", "!=", "<", "<=", ">", ">=" };
+
+// Mostly small numbers, but also the large ones that overflow arithmetic.
+int32_t randomNumber( Generator * gen ) {
+    static int32_t large[] = { 2147483647, 2147483646, 1073741824, 65536, 65535, 46341, 1000000007 };
+    switch( randomBelow( &gen->random, 10 ) ) {
+        case 0:  return large[randomBelow( &gen->random, sizeof(large) / sizeof(large[0]) )];
+        case 1:  return (int32_t) (nextRandom( &gen->random ) & 0x7fffffff);
+        case 2:  return randomBelow( &gen->random, 1000 );
+        default: return randomBelow( &gen->random, 11 );
+    }
+}
+
+void genNewline( Generator * gen ) {
+    int idx;
+    if( chance( &gen->random, 3 ) ) append( gen->out, "  // %d", randomBelow( &gen->random, 100 ) );
+    append( gen->out, "\n" );
+    for( idx = 0; idx < gen->indent; idx++ ) append( gen->out, "  " );
+}
+
+void genExpr( Generator * gen, int depth );
+
+void genFactor( Generator * gen, int depth ) {
+    int choice = depth <= 0 ? randomBelow( &gen->random, 2 ) : randomBelow( &gen->random, 5 );
+    if( choice == 0 )      append( gen->out, "%s", gen->names[randomBelow( &gen->random, gen->nVariables )] );
+    else if( choice == 1 ) append( gen->out, "%d", randomNumber( gen ) );
+    else if( choice == 2 ) append( gen->out, "%d", randomBelow( &gen->random, 3 ) );
+    else {
+        append( gen->out, "(" );
+        genExpr( gen, depth - 1 );
+        append( gen->out, ")" );
+    }
+}
+
+void genTerm( Generator * gen, int depth ) {
+    if( depth <= 0 || chance( &gen->random, 50 ) ) {
+        genFactor( gen, depth );
+        return;
+    }
+    genTerm( gen, depth - 1 );
+    switch( randomBelow( &gen->random, 3 ) ) {
+        case 0:
+            append( gen->out, " * " );
+            genFactor( gen, depth - 1 );
+            break;
+        default:
+            // Dividing by a variable risks dividing by 0, which leaves the run's result undefined.
+            append( gen->out, "%s", randomBelow( &gen->random, 2 ) ? " / " : " % " );
+            if( chance( &gen->random, 70 ) ) append( gen->out, "%d", 1 + randomBelow( &gen->random, 10 ) );
+            else                             genFactor( gen, depth - 1 );
+    }
+}
+
+void genExpr( Generator * gen, int depth ) {
+    if( depth <= 0 || chance( &gen->random, 40 ) ) {
+        genTerm( gen, depth );
+        return;
+    }
+    genExpr( gen, depth - 1 );
+    append( gen->out, "%s", randomBelow( &gen->random, 2 ) ? " + " : " - " );
+    genTerm( gen, depth - 1 );
+}
+
+void genTest( Generator * gen ) {
+    genExpr( gen, randomBelow( &gen->random, 3 ) );
+    append( gen->out, " %s ", relops[randomBelow( &gen->random, 6 )] );
+    genExpr( gen, randomBelow( &gen->random, 3 ) );
+}
+
+// A variable that may be assigned to, or -1 if there isn't one.
+int unlockedVariable( Generator * gen ) {
+    int tries;
+    for( tries = 0; tries < 8; tries++ ) {
+        int var = randomBelow( &gen->random, gen->nVariables );
+        if( ! gen->locked[var] ) return var;
+    }
+    return -1;
+}
+
+void genStatements( Generator * gen, int depth, int count );
+
+void genBlock( Generator * gen, int depth ) {
+    append( gen->out, "{" );
+    gen->indent++;
+    genStatements( gen, depth, randomBelow( &gen->random, 4 ) );
+    gen->indent--;
+    genNewline( gen );
+    append( gen->out, "}" );
+}
+
+void genStatement( Generator * gen, int depth ) {
+    int choice = depth <= 0 ? randomBelow( &gen->random, 2 ) : randomBelow( &gen->random, 4 );
+    int var    = unlockedVariable( gen );
+
+    if( choice == 1 || var < 0 ) {
+        append( gen->out, "println(" );
+        genExpr( gen, randomBelow( &gen->random, 4 ) );
+        append( gen->out, ");" );
+    } else if( choice == 0 ) {
+        int parens = chance( &gen->random, 15 ) ? 1 + randomBelow( &gen->random, 2 ) : 0;
+        append( gen->out, "%.*s%s%.*s = ", parens, "((", gen->names[var], parens, "))" );
+        genExpr( gen, randomBelow( &gen->random, 5 ) );
+        append( gen->out, ";" );
+    } else if( choice == 2 ) {
+        append( gen->out, "if (" );
+        genTest( gen );
+        append( gen->out, ") " );
+        genBlock( gen, depth - 1 );
+        append( gen->out, " else " );
+        genBlock( gen, depth - 1 );
+    } else {
+        // var = 0; while (var < k) { ... var = var + 1; } - or counting down from k to 0.
+        int  bound = randomBelow( &gen->random, 5 );
+        bool up    = chance( &gen->random, 50 );
+        if( up ) append( gen->out, "%s = 0;", gen->names[var] );
+        else     append( gen->out, "%s = %d;", gen->names[var], bound );
+        genNewline( gen );
+        if( up ) append( gen->out, "while (%s < %d) {", gen->names[var], bound );
+        else     append( gen->out, "while (%s > 0) {", gen->names[var] );
+        gen->locked[var] = true;
+        gen->indent++;
+        genStatements( gen, depth - 1, randomBelow( &gen->random, 4 ) );
+        genNewline( gen );
+        append( gen->out, "%s = %s %c 1;", gen->names[var], gen->names[var], up ? '+' : '-' );
+        gen->indent--;
+        gen->locked[var] = false;
+        genNewline( gen );
+        append( gen->out, "}" );
+    }
+}
+
+void genStatements( Generator * gen, int depth, int count ) {
+    int idx;
+    for( idx = 0; idx < count; idx++ ) {
+        genNewline( gen );
+        genStatement( gen, depth );
+    }
+}
+
+// Write a random program to out.
+void generateProgram( uint64_t seed, Text * out ) {
+    Generator   gen;
+    int         nDcls, idx;
+
+    memset( &gen, 0, sizeof(gen) );
+    gen.random = seed;
+    gen.out    = out;
+    clearText( out );
+
+    if( chance( &gen.random, 80 ) ) {
+        strcpy( gen.names[0], "a" );
+        strcpy( gen.names[1], "b" );
+    } else {
+        snprintf( gen.names[0], sizeof(gen.names[0]), "%s0", nameStems[randomBelow( &gen.random, 13 )] );
+        snprintf( gen.names[1], sizeof(gen.names[1]), "%s1", nameStems[randomBelow( &gen.random, 13 )] );
+    }
+    gen.nVariables = 2;
+    append( out, "int wain(int %s, int %s) {", gen.names[0], gen.names[1] );
+    gen.indent = 1;
+
+    nDcls = randomBelow( &gen.random, 6 );
+    for( idx = 0; idx < nDcls; idx++ ) {
+        snprintf( gen.names[gen.nVariables], sizeof(gen.names[0]), "%s%d",
+                  nameStems[randomBelow( &gen.random, 13 )], gen.nVariables );
+        genNewline( &gen );
+        append( out, "int %s = %d;", gen.names[gen.nVariables], randomNumber( &gen ) );
+        gen.nVariables++;
+    }
+    genStatements( &gen, 3, 1 + randomBelow( &gen.random, 8 ) );
+    genNewline( &gen );
+    append( out, "return " );
+    genExpr( &gen, randomBelow( &gen.random, 5 ) );
+    append( out, ";\n}\n" );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// The reference interpreter.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Evaluates the parse tree of a program directly. Arithmetic wraps around at 32 bits, and division
+// truncates towards 0 as div does - with INT_MIN / -1 giving INT_MIN, remainder 0, as on the emulator.
+
+typedef enum { RUN_OK, RUN_INVALID, RUN_UNDEFINED, RUN_TOO_LONG } RunOutcome;
+
+typedef struct Interpreter {
+    ParseTree * parse;
+    int       * slotOf;                     // For each ID node, the index of its variable in values.
+    int         nVariables;
+    int32_t     values[MAX_VARIABLES];
+    int32_t     initial[MAX_VARIABLES];     // What the dcls initialize the variables to.
+    long        steps;
+    Text        output;
+    jmp_buf     stop;                       // Where a run that goes wrong longjmp's back to.
+} Interpreter;
+
+typedef struct Trial {
+    int32_t     a, b;
+    RunOutcome  outcome;
+    int32_t     returned;                   // With the output, what the interpreter says the program does.
+    Text        output;
+} Trial;
+
+int32_t numberIn( ParseTree * parse, TreePtr num ) {
+    uint32_t value = 0;
+    int      idx;
+    for( idx = 0; idx < num->lexemeLength; idx++ ) value = 10 * value + (lexemeOf(parse,num)[idx] - '0');
+    return (int32_t) value;
+}
+
+// Give the variable declared by the ID node id the next slot; false if it's already declared.
+bool declare( Interpreter * in, TreePtr id ) {
+    ParseTree * parse = in->parse;
+    int         var;
+    for( var = 0; var < in->nVariables; var++ ) {
+        TreePtr declared = &parse->nodes[in->slotOf[parse->nNodes + var]];
+        if( declared->lexemeLength == id->lexemeLength
+            && ! memcmp( lexemeOf(parse,declared), lexemeOf(parse,id), id->lexemeLength ) ) return false;
+    }
+    if( in->nVariables == MAX_VARIABLES ) return false;
+    in->slotOf[parse->nNodes + in->nVariables] = id - parse->nodes;
+    in->slotOf[id - parse->nodes] = in->nVariables++;
+    return true;
+}
+
+// Check that every variable is declared exactly once, and note which variable each ID stands for. slotOf
+// has a slot for each node followed by one for each variable, which records the ID node declaring it.
+bool bindVariables( Interpreter * in ) {
+    ParseTree * parse     = in->parse;
+    TreePtr     procedure = childOf( parse, &parse->nodes[0], 1 );
+    TreePtr     dcls;
+    int         node, var;
+
+    in->slotOf     = realloc( in->slotOf, (parse->nNodes + MAX_VARIABLES) * sizeof(int) );
+    in->nVariables = 0;
+    if( in->slotOf == NULL ) panicExit( "out of memory" );
+    if( ! declare( in, childOf( parse, childOf( parse, procedure, 3 ), 1 ) ) ) return false;
+    if( ! declare( in, childOf( parse, childOf( parse, procedure, 5 ), 1 ) ) ) return false;
+
+    // dcls --> dcls dcl BECOMES NUM SEMI leans to the left, so the first dcl is at the bottom.
+    for( dcls = childOf( parse, procedure, 8 ); dcls->nChildren > 0; dcls = childOf( parse, dcls, 0 ) ) {
+        pushWork( parse, dcls );
+    }
+    while( parse->nWork > 0 ) {
+        dcls = popWork( parse );
+        if( ! declare( in, childOf( parse, childOf( parse, dcls, 1 ), 1 ) ) ) return false;
+        in->initial[in->nVariables - 1] = numberIn( parse, childOf( parse, dcls, 3 ) );
+    }
+
+    for( node = 0; node < parse->nNodes; node++ ) {
+        TreePtr tree = &parse->nodes[node];
+        TreePtr id;
+        if( tree->ruleId != RULE_FACTOR_ID && tree->ruleId != RULE_LVALUE_ID ) continue;
+        id = childOf( parse, tree, 0 );
+        for( var = 0; var < in->nVariables; var++ ) {
+            TreePtr declared = &parse->nodes[in->slotOf[parse->nNodes + var]];
+            if( declared->lexemeLength == id->lexemeLength
+                && ! memcmp( lexemeOf(parse,declared), lexemeOf(parse,id), id->lexemeLength ) ) break;
+        }
+        if( var == in->nVariables ) return false;
+        in->slotOf[id - parse->nodes] = var;
+    }
+    return true;
+}
+
+void step( Interpreter * in ) {
+    if( ++in->steps > MAX_INTERPRETER_STEPS ) longjmp( in->stop, RUN_TOO_LONG );
+}
+
+int32_t evaluate( Interpreter * in, TreePtr tree ) {
+    ParseTree * parse = in->parse;
+    uint32_t    left, right;
+
+    switch( tree->ruleId ) {
+        case RULE_EXPR_TERM: case RULE_TERM_FACTOR:
+            return evaluate( in, childOf( parse, tree, 0 ) );
+        case RULE_FACTOR_ID:
+            return in->values[in->slotOf[tree->firstChild]];
+        case RULE_FACTOR_NUM:
+            return numberIn( parse, childOf( parse, tree, 0 ) );
+        case RULE_FACTOR_PARENS:
+            return evaluate( in, childOf( parse, tree, 1 ) );
+        default:
+            break;
+    }
+    left  = (uint32_t) evaluate( in, childOf( parse, tree, 0 ) );
+    right = (uint32_t) evaluate( in, childOf( parse, tree, 2 ) );
+    switch( tree->ruleId ) {
+        case RULE_EXPR_PLUS:  return (int32_t) (left + right);
+        case RULE_EXPR_MINUS: return (int32_t) (left - right);
+        case RULE_TERM_STAR:  return (int32_t) (left * right);
+        case RULE_TERM_SLASH:
+        case RULE_TERM_PCT:
+            if( right == 0 ) longjmp( in->stop, RUN_UNDEFINED );
+            if( (int32_t) left == INT_MIN && (int32_t) right == -1 ) return tree->ruleId == RULE_TERM_SLASH ? INT_MIN : 0;
+            return tree->ruleId == RULE_TERM_SLASH ? (int32_t) left / (int32_t) right : (int32_t) left % (int32_t) right;
+        default:
+            bail( parse, tree );
+            return 0;
+    }
+}
+
+bool holds( Interpreter * in, TreePtr test ) {
+    int32_t left  = evaluate( in, childOf( in->parse, test, 0 ) );
+    int32_t right = evaluate( in, childOf( in->parse, test, 2 ) );
+    switch( test->ruleId ) {
+        case RULE_TEST_EQ: return left == right;
+        case RULE_TEST_NE: return left != right;
+        case RULE_TEST_LT: return left <  right;
+        case RULE_TEST_LE: return left <= right;
+        case RULE_TEST_GE: return left >= right;
+        case RULE_TEST_GT: return left >  right;
+        default:           bail( in->parse, test ); return false;
+    }
+}
+
+void execute( Interpreter * in, TreePtr statements ) {
+    ParseTree * parse = in->parse;
+    TreePtr     statement, lvalue;
+
+    if( statements->nChildren == 0 ) return;
+    execute( in, childOf( parse, statements, 0 ) );
+    statement = childOf( parse, statements, 1 );
+    step( in );
+    switch( statement->ruleId ) {
+        case RULE_STATEMENT_ASSIGN:
+            for( lvalue = childOf( parse, statement, 0 ); lvalue->ruleId == RULE_LVALUE_PARENS; ) {
+                lvalue = childOf( parse, lvalue, 1 );
+            }
+            in->values[in->slotOf[lvalue->firstChild]] = evaluate( in, childOf( parse, statement, 2 ) );
+            break;
+        case RULE_STATEMENT_IF:
+            execute( in, childOf( parse, statement, holds( in, childOf( parse, statement, 2 ) ) ? 5 : 9 ) );
+            break;
+        case RULE_STATEMENT_WHILE:
+            while( holds( in, childOf( parse, statement, 2 ) ) ) {
+                execute( in, childOf( parse, statement, 5 ) );
+                step( in );
+            }
+            break;
+        case RULE_STATEMENT_PRINTLN:
+            append( &in->output, "%d\n", evaluate( in, childOf( parse, statement, 2 ) ) );
+            break;
+        default:
+            bail( parse, statement );
+    }
+}
+
+// Run the program on the trial's inputs, recording the outcome in trial.
+void interpret( Interpreter * in, Trial * trial ) {
+    TreePtr procedure = childOf( in->parse, &in->parse->nodes[0], 1 );
+    int     outcome;
+
+    memcpy( in->values, in->initial, sizeof(in->values) );
+    in->values[0] = trial->a;
+    in->values[1] = trial->b;
+    in->steps     = 0;
+    clearText( &in->output );
+    if( (outcome = setjmp( in->stop )) == 0 ) {
+        execute( in, childOf( in->parse, procedure, 9 ) );
+        trial->returned = evaluate( in, childOf( in->parse, procedure, 11 ) );
+        outcome = RUN_OK;
+    }
+    trial->outcome = outcome;
+    copyText( &trial->output, &in->output );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// Compiling and running programs.
+//
+// -----------------------------------------------------------------------------------------------------
+
+typedef struct Fuzzer {
+    int             fd;                     // A scratch file holding the program being tried.
+    MipsMachine   * machine;                // The compiled program is loaded here.
+    uint32_t      * words;
+    size_t          maxWords;
+    Interpreter     interpreter;
+    Text            source;
+    Text            scratch;
+} Fuzzer;
+
+void writeSource( Fuzzer * fuzzer, Text * source ) {
+    if( ftruncate( fuzzer->fd, 0 ) != 0 || pwrite( fuzzer->fd, source->chars, source->length, 0 ) != (ssize_t) source->length ) {
+        panicExit( "can't write the scratch file" );
+    }
+    lseek( fuzzer->fd, 0, SEEK_SET );
+}
+
+// Parse the program in the scratch file with wlgen's pass one and bind its variables, for the interpreter.
+// Returns false, with errorMessage saying why if wlgen rejected it, if it isn't a valid program.
+bool parseForInterpreter( Fuzzer * fuzzer ) {
+    Interpreter         * in = &fuzzer->interpreter;
+    jmp_buf               recovery;
+    volatile bool         parsed = false;
+
+    if( in->parse != NULL ) freeParseTree( in->parse );
+    in->parse = newParseTree();
+    lseek( fuzzer->fd, 0, SEEK_SET );
+    errorRecovery = &recovery;
+    if( setjmp( recovery ) == 0 ) {
+        readParse( in->parse, fuzzer->fd );
+        parsed = true;
+    }
+    errorRecovery = NULL;
+    if( ! parsed ) return false;
+    if( bindVariables( in ) ) return true;
+    snprintf( errorMessage, sizeof(errorMessage), "ERROR: a variable is undeclared or declared twice" );
+    return false;
+}
+
+// Compile the program in the scratch file and load the code into the emulator. Returns false, with
+// errorMessage saying why, if wlgen failed to compile it.
+bool compileForEmulator( Fuzzer * fuzzer, bool optimized ) {
+    char   * code = NULL;
+    size_t   size = 0, idx;
+    FILE   * sink = open_memstream( &code, &size );
+    bool     compiled;
+
+    if( sink == NULL ) panicExit( "out of memory" );
+    lseek( fuzzer->fd, 0, SEEK_SET );
+    emitMachineCode = true;
+    optimize        = optimized;
+    compiled        = compile( fuzzer->fd, sink );
+    fclose( sink );
+
+    if( compiled ) {
+        size_t nWords = size / 4;
+        if( nWords > fuzzer->maxWords ) {
+            fuzzer->words    = realloc( fuzzer->words, nWords * sizeof(uint32_t) );
+            fuzzer->maxWords = nWords;
+            if( fuzzer->words == NULL ) panicExit( "out of memory" );
+        }
+        for( idx = 0; idx < nWords; idx++ ) {
+            unsigned char * bytes = (unsigned char *) code + 4 * idx;
+            fuzzer->words[idx] = (uint32_t) bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3];
+        }
+        if( ! mipsLoad( fuzzer->machine, fuzzer->words, nWords ) ) {
+            snprintf( errorMessage, sizeof(errorMessage), "ERROR: the generated code doesn't fit in memory" );
+            compiled = false;
+        }
+    }
+    free( code );
+    return compiled;
+}
+
+// Run the loaded code on the trial's inputs. Returns true if it did what the interpreter said it should;
+// otherwise why says what it did instead.
+bool runMatches( Fuzzer * fuzzer, Trial * trial, char * why, size_t size ) {
+    MipsMachine * machine = fuzzer->machine;
+    MipsStatus    status  = mipsRunTwoInts( machine, trial->a, trial->b, MAX_EMULATOR_STEPS );
+
+    if( status == MIPS_ERROR ) {
+        snprintf( why, size, "the code failed: %s", machine->error );
+    } else if( status != MIPS_HALTED ) {
+        snprintf( why, size, "the code didn't halt" );
+    } else if( (int32_t) machine->reg[3] != trial->returned ) {
+        snprintf( why, size, "returned %d instead of %d", (int32_t) machine->reg[3], trial->returned );
+    } else if( machine->outputLength != trial->output.length || memcmp( machine->output, trial->output.chars, trial->output.length ) ) {
+        snprintf( why, size, "printed the wrong output" );
+    } else {
+        return true;
+    }
+    return false;
+}
+
+typedef enum { VERDICT_PASSED, VERDICT_FAILED, VERDICT_INVALID } Verdict;
+
+// Whether wlgen gets the program in source wrong for the trial's inputs (with -O if optimized). Programs that
+// aren't valid, or whose result for the inputs is undefined, can't tell.
+Verdict check( Fuzzer * fuzzer, Text * source, Trial * trial, bool optimized, char * why, size_t size ) {
+    writeSource( fuzzer, source );
+    if( ! parseForInterpreter( fuzzer ) ) return VERDICT_INVALID;
+    if( ! compileForEmulator( fuzzer, optimized ) ) {
+        snprintf( why, size, "wlgen rejected it: %s", errorMessage );
+        return VERDICT_FAILED;
+    }
+    interpret( &fuzzer->interpreter, trial );
+    if( trial->outcome != RUN_OK ) return VERDICT_INVALID;
+    return runMatches( fuzzer, trial, why, size ) ? VERDICT_PASSED : VERDICT_FAILED;
+}
+
+// check(...) in a child process, so that wlgen crashing or hanging on the program counts as a failure
+// rather than bringing the fuzzer down.
+Verdict checkInChild( Fuzzer * fuzzer, Text * source, Trial * trial, bool optimized, char * why, size_t size ) {
+    int       pipeFds[2];
+    pid_t     child;
+    int       status;
+    ssize_t   length, total = 0;
+
+    if( pipe( pipeFds ) != 0 ) panicExit( "can't create a pipe" );
+    fflush( stdout );
+    child = fork();
+    if( child < 0 ) panicExit( "fork failed" );
+    if( child == 0 ) {
+        Verdict   verdict;
+        FILE    * scratch = tmpfile();          // The parent's tree may still be mapped from its scratch file.
+        close( pipeFds[0] );
+        if( scratch == NULL ) _exit( VERDICT_INVALID );
+        fuzzer->fd = fileno( scratch );
+        alarm( REDUCTION_TIMEOUT );
+        why[0]  = '\0';
+        verdict = check( fuzzer, source, trial, optimized, why, size );
+        if( write( pipeFds[1], why, strlen( why ) ) < 0 ) _exit( VERDICT_INVALID );
+        _exit( verdict );
+    }
+    close( pipeFds[1] );
+    while( total + 1 < (ssize_t) size && (length = read( pipeFds[0], why + total, size - 1 - total )) > 0 ) total += length;
+    why[total] = '\0';
+    close( pipeFds[0] );
+    if( waitpid( child, &status, 0 ) < 0 ) panicExit( "waitpid failed" );
+    if( WIFEXITED( status ) ) return (Verdict) WEXITSTATUS( status );
+    if( WTERMSIG( status ) == SIGALRM ) snprintf( why, size, "wlgen hung" );
+    else                                snprintf( why, size, "wlgen crashed (signal %d)", WTERMSIG( status ) );
+    return VERDICT_FAILED;
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// Reducing failures.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Reduction works on the parse tree of the program: each candidate is the program printed back out as
+// source with one node replaced - by one of its own descendants (eg an if statement by the statements of
+// one of its branches, or a list of statements by the list without its last statement) or, for a NUM or a
+// variable in an expression, by a smaller number. The first candidate that is shorter and still fails
+// becomes the program, and the search starts again, until no candidate fails.
+
+typedef struct Printer {
+    Text    * out;
+    int       indent;
+    SymbolId  previous;                     // The last terminal printed, or SYM_BOF.
+    bool      newlinePending;
+    TreePtr   target;                       // Printed as replacement (a node) or as literal (if not NULL).
+    TreePtr   replacement;
+    char    * literal;
+} Printer;
+
+void printTerminal( Printer * printer, SymbolId symbol, char * lexeme, int length ) {
+    int idx;
+    if( length == 0 ) return;                                           // BOF and EOF.
+    if( symbol == SYM_RBRACE ) printer->indent--;
+    if( printer->newlinePending && symbol != SYM_ELSE ) {
+        append( printer->out, "\n" );
+        for( idx = 0; idx < printer->indent; idx++ ) append( printer->out, "  " );
+    } else if( printer->previous != SYM_BOF && printer->previous != SYM_LPAREN && symbol != SYM_RPAREN
+               && symbol != SYM_SEMI && symbol != SYM_COMMA
+               && ! (symbol == SYM_LPAREN && (printer->previous == SYM_PRINTLN || printer->previous == SYM_WAIN)) ) {
+        append( printer->out, " " );
+    }
+    appendBytes( printer->out, lexeme, length );
+    if( symbol == SYM_LBRACE ) printer->indent++;
+    printer->newlinePending = symbol == SYM_SEMI || symbol == SYM_LBRACE || symbol == SYM_RBRACE;
+    printer->previous       = symbol;
+}
+
+void printSource( Printer * printer, ParseTree * parse, TreePtr tree ) {
+    int child;
+    if( tree == printer->target ) {
+        if( printer->literal != NULL ) {
+            printTerminal( printer, SYM_NUM, printer->literal, strlen( printer->literal ) );
+            return;
+        }
+        tree = printer->replacement;
+    }
+    if( tree->ruleId == RULE_TERMINAL ) {
+        printTerminal( printer, tree->symbol, lexemeOf(parse,tree), tree->lexemeLength );
+        return;
+    }
+    for( child = 0; child < tree->nChildren; child++ ) printSource( printer, parse, childOf( parse, tree, child ) );
+}
+
+// Print the program parsed into parse to out, with target (if not NULL) replaced.
+void printProgram( ParseTree * parse, Text * out, TreePtr target, TreePtr replacement, char * literal ) {
+    Printer printer = { out, 0, SYM_BOF, false, target, replacement, literal };
+    clearText( out );
+    printSource( &printer, parse, &parse->nodes[0] );
+    append( out, "\n" );
+}
+
+// The children of tree that may replace it, as a list of child indexes ending with -1.
+int * replacementsFor( TreePtr tree ) {
+    static int statements[] = { 0, -1 }, ifs[] = { 5, 9, -1 }, whiles[] = { 5, -1 }, operands[] = { 0, 2, -1 },
+               parens[] = { 1, -1 }, none[] = { -1 };
+    switch( tree->ruleId ) {
+        case RULE_STATEMENTS: case RULE_DCLS:                               return statements;
+        case RULE_STATEMENT_IF:                                             return ifs;
+        case RULE_STATEMENT_WHILE:                                          return whiles;
+        case RULE_EXPR_PLUS: case RULE_EXPR_MINUS:
+        case RULE_TERM_STAR: case RULE_TERM_SLASH: case RULE_TERM_PCT:     return operands;
+        case RULE_FACTOR_PARENS: case RULE_LVALUE_PARENS:                   return parens;
+        default:                                                            return none;
+    }
+}
+
+typedef struct Reduction {
+    Fuzzer    * fuzzer;
+    size_t      shortest;                   // The length of the smallest failing program so far.
+    Trial     * trial;                      // What it fails on ...
+    bool        optimized;                  // ... and whether with -O.
+    Text        candidate;
+    char        reason[WHY_SIZE];           // How the candidate failed.
+} Reduction;
+
+// Whether the program parsed into parse, with target replaced, is shorter than the smallest failing program
+// so far and still fails; either way it's left in reduction->candidate.
+bool stillFails( Reduction * reduction, ParseTree * parse, TreePtr target, TreePtr replacement, char * literal ) {
+    printProgram( parse, &reduction->candidate, target, replacement, literal );
+    return reduction->candidate.length < reduction->shortest
+           && checkInChild( reduction->fuzzer, &reduction->candidate, reduction->trial, reduction->optimized,
+                            reduction->reason, sizeof(reduction->reason) ) == VERDICT_FAILED;
+}
+
+// Try each candidate for replacing tree, stopping at the first that still fails.
+bool reduceNode( Reduction * reduction, ParseTree * parse, TreePtr tree ) {
+    char    number[16];
+    int     idx, * children;
+
+    if( tree->ruleId == RULE_FACTOR_ID ) return stillFails( reduction, parse, tree, NULL, "0" );    // Which may leave its dcl unused.
+    if( tree->ruleId == RULE_TERMINAL && tree->symbol == SYM_NUM ) {
+        int32_t value     = numberIn( parse, tree );
+        int32_t smaller[] = { 0, 1, value / 2 };
+        for( idx = 0; idx < 3; idx++ ) {
+            snprintf( number, sizeof(number), "%d", smaller[idx] );
+            if( stillFails( reduction, parse, tree, NULL, number ) ) return true;
+        }
+        return false;
+    }
+    for( children = replacementsFor( tree ); *children >= 0; children++ ) {
+        if( stillFails( reduction, parse, tree, childOf( parse, tree, *children ), NULL ) ) return true;
+    }
+    return false;
+}
+
+// Replace source by a reduced program that still fails the trial. Ends up with why describing the failure.
+void reduce( Fuzzer * fuzzer, Text * source, Trial * trial, bool optimized, char * why, size_t size ) {
+    Reduction   reduction;
+    bool        reduced   = true;
+    int         node;
+
+    memset( &reduction, 0, sizeof(reduction) );
+    reduction.fuzzer    = fuzzer;
+    reduction.shortest  = SIZE_MAX;
+    reduction.trial     = trial;
+    reduction.optimized = optimized;
+
+    // Start from the program as the printer prints it, so that only the replacements change its length.
+    writeSource( fuzzer, source );
+    if( parseForInterpreter( fuzzer ) && stillFails( &reduction, fuzzer->interpreter.parse, NULL, NULL, NULL ) ) {
+        copyText( source, &reduction.candidate );
+        snprintf( why, size, "%s", reduction.reason );
+    }
+
+    while( reduced ) {
+        ParseTree * parse;
+        reduced = false;
+        reduction.shortest = source->length;
+        writeSource( fuzzer, source );
+        if( ! parseForInterpreter( fuzzer ) ) break;
+        parse = fuzzer->interpreter.parse;
+        for( node = 0; node < parse->nNodes && ! reduced; node++ ) reduced = reduceNode( &reduction, parse, &parse->nodes[node] );
+        if( reduced ) {
+            copyText( source, &reduction.candidate );
+            snprintf( why, size, "%s", reduction.reason );
+        }
+    }
+    free( reduction.candidate.chars );
+}
+
+// Save the failing program as a test case in outDir and print it.
+void saveFailure( Fuzzer * fuzzer, Text * source, Trial * trial, bool optimized, char * why,
+                  char * outDir, uint64_t seed, long program ) {
+    Text        yaml   = { NULL };
+    Text        path   = { NULL };
+    Text        report = { NULL };
+    char      * line, * end;
+    FILE      * file;
+
+    // The interpreter says what the reduced program should do (it may have crashed wlgen, leaving trial as
+    // it was for the original program).
+    writeSource( fuzzer, source );
+    if( parseForInterpreter( fuzzer ) ) interpret( &fuzzer->interpreter, trial );
+
+    append( &yaml, "# Found by wlfuzz --seed %llu (program %ld): %s%s\n", (unsigned long long) seed, program,
+            optimized ? "with -O, " : "", why );
+    append( &yaml, "wl_input: |\n" );
+    for( line = source->chars; *line != '\0'; line = end + 1 ) {
+        end = strchr( line, '\n' );
+        append( &yaml, "  %.*s\n", (int) (end - line), line );
+    }
+    append( &yaml, "valid: true\ntrials:\n  -\n    input: %d %d\n    return_val: %d\n", trial->a, trial->b, trial->returned );
+    if( trial->output.length > 0 ) {
+        append( &yaml, "    output: |\n" );
+        for( line = trial->output.chars; *line != '\0'; line = end + 1 ) {
+            end = strchr( line, '\n' );
+            append( &yaml, "      %.*s\n", (int) (end - line), line );
+        }
+    }
+
+    if( mkdir( outDir, 0777 ) != 0 && errno != EEXIST ) panicExit( "can't create the output directory" );
+    append( &path, "%s/fuzz_%08x.yaml", outDir, hashOf( source->chars, source->length ) );
+    if( (file = fopen( path.chars, "w" )) == NULL || fwrite( yaml.chars, 1, yaml.length, file ) != yaml.length || fclose( file ) != 0 ) {
+        panicExit( "can't write the test case" );
+    }
+
+    // One write(...), so that the reports of different workers don't interleave.
+    append( &report, "FAILED: program %ld: %s%s\n%s", program, optimized ? "with -O, " : "", why, source->chars );
+    append( &report, "with a = %d, b = %d; saved as %s\n\n", trial->a, trial->b, path.chars );
+    if( write( STDOUT_FILENO, report.chars, report.length ) < 0 ) panicExit( "can't write the report" );
+    free( report.chars );
+    free( path.chars );
+    free( yaml.chars );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+//
+// The workers.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// What each worker is up to, in memory shared with the main process. Only the worker writes its slot.
+typedef struct WorkerSlot {
+    volatile long       program;            // The program being tested, or -1 once the worker is done.
+    volatile long       programs;           // How many programs, and trials of them, it has tested ...
+    volatile long       trials;
+    volatile long       skipped;            // ... and how many trials had no defined result.
+    volatile int32_t    a, b;               // The trial being run, ...
+    volatile bool       optimized;          // ... and whether the code was compiled with -O.
+    volatile int        sourceLength;
+    char                source[MAX_SOURCE]; // The program being tested, in case wlgen crashes on it.
+} WorkerSlot;
+
+typedef struct Shared {
+    volatile int        failures;
+    volatile bool       stop;
+    WorkerSlot          slots[];
+} Shared;
+
+typedef struct Options {
+    int         jobs;
+    double      seconds;
+    long        programs;                   // 0 for no limit.
+    uint64_t    seed;
+    int         maxFailures;
+    char      * outDir;
+} Options;
+
+int32_t edgeValues[] = { 0, 1, -1, 2, -2, 7, 10, INT_MIN, INT_MAX, INT_MIN + 1, INT_MAX - 1, 65536 };
+
+// Random inputs, leaning on the values at the edges of the range.
+int32_t randomInput( uint64_t * random ) {
+    switch( randomBelow( random, 3 ) ) {
+        case 0:  return edgeValues[randomBelow( random, sizeof(edgeValues) / sizeof(edgeValues[0]) )];
+        case 1:  return randomBelow( random, 41 ) - 20;
+        default: return (int32_t) (uint32_t) nextRandom( random );
+    }
+}
+
+// Every random choice made for program n follows from the seed and n.
+uint64_t programSeed( uint64_t seed, long program ) {
+    uint64_t state = seed ^ (0x5851f42d4c957f2dULL * (uint64_t) (program + 1));
+    return nextRandom( &state );
+}
+
+// Reduce the failing program, save it and count it.
+void fail( Fuzzer * fuzzer, Shared * shared, Options * options, long program, Trial * trial, bool optimized,
+           char * why ) {
+    char reason[WHY_SIZE];
+    snprintf( reason, sizeof(reason), "%s", why );
+    reduce( fuzzer, &fuzzer->source, trial, optimized, reason, sizeof(reason) );
+    saveFailure( fuzzer, &fuzzer->source, trial, optimized, reason, options->outDir, options->seed, program );
+    if( __sync_add_and_fetch( &shared->failures, 1 ) >= options->maxFailures ) shared->stop = true;
+}
+
+// Generate program n and test it on each of its trials, with and without -O.
+void fuzzProgram( Fuzzer * fuzzer, Shared * shared, WorkerSlot * slot, Options * options, long program ) {
+    uint64_t    random = programSeed( options->seed, program );
+    Trial       trials[MAX_TRIALS];
+    int         nTrials = 3 + randomBelow( &random, MAX_TRIALS - 2 );
+    int         idx, pass;
+    char        why[WHY_SIZE];
+
+    generateProgram( nextRandom( &random ), &fuzzer->source );
+    if( fuzzer->source.length >= MAX_SOURCE ) {     // Too long to save if wlgen crashed on it, so skip it.
+        slot->programs++;
+        return;
+    }
+    slot->sourceLength = fuzzer->source.length;
+    memcpy( slot->source, fuzzer->source.chars, slot->sourceLength );
+    slot->program = program;
+
+    memset( trials, 0, sizeof(trials) );
+    for( idx = 0; idx < nTrials; idx++ ) {
+        trials[idx].a = randomInput( &random );
+        trials[idx].b = randomInput( &random );
+    }
+    slot->a = trials[0].a;
+    slot->b = trials[0].b;
+    slot->optimized = false;
+
+    writeSource( fuzzer, &fuzzer->source );
+    if( ! parseForInterpreter( fuzzer ) ) {
+        snprintf( why, sizeof(why), "wlgen rejected it: %s", errorMessage );
+        fail( fuzzer, shared, options, program, &trials[0], false, why );
+        goto done;
+    }
+    for( idx = 0; idx < nTrials; idx++ ) {
+        interpret( &fuzzer->interpreter, &trials[idx] );
+        if( trials[idx].outcome != RUN_OK ) slot->skipped++;
+    }
+
+    for( pass = 0; pass < 2; pass++ ) {
+        bool optimized = pass == 1;
+        slot->optimized = optimized;
+        if( ! compileForEmulator( fuzzer, optimized ) ) {
+            snprintf( why, sizeof(why), "wlgen rejected it: %s", errorMessage );
+            fail( fuzzer, shared, options, program, &trials[0], optimized, why );
+            goto done;
+        }
+        for( idx = 0; idx < nTrials; idx++ ) {
+            if( trials[idx].outcome != RUN_OK ) continue;
+            slot->a = trials[idx].a;
+            slot->b = trials[idx].b;
+            slot->trials++;
+            if( ! runMatches( fuzzer, &trials[idx], why, sizeof(why) ) ) {
+                fail( fuzzer, shared, options, program, &trials[idx], optimized, why );
+                goto done;
+            }
+        }
+    }
+
+done:
+    for( idx = 0; idx < nTrials; idx++ ) free( trials[idx].output.chars );
+    slot->programs++;
+}
+
+void initFuzzer( Fuzzer * fuzzer ) {
+    FILE * scratch = tmpfile();
+    memset( fuzzer, 0, sizeof(*fuzzer) );
+    if( scratch == NULL ) panicExit( "can't create a temporary file" );
+    fuzzer->fd      = fileno( scratch );
+    fuzzer->machine = newMipsMachine( MIPS_MEMORY_SIZE );
+    if( fuzzer->machine == NULL ) panicExit( "out of memory" );
+}
+
+// Test programs worker, worker + jobs, worker + 2 * jobs, ... starting from first, until told to stop.
+void runWorker( Shared * shared, Options * options, int worker, long first ) {
+    WorkerSlot * slot = &shared->slots[worker];
+    Fuzzer       fuzzer;
+    long         program;
+
+    initFuzzer( &fuzzer );
+    for( program = first; ! shared->stop && (options->programs == 0 || program < options->programs); program += options->jobs ) {
+        fuzzProgram( &fuzzer, shared, slot, options, program );
+    }
+    slot->program = -1;
+    _exit(0);
+}
+
+// A worker crashed - so wlgen crashed - testing the program in its slot: reduce and save that program, then
+// carry on with the worker's next one.
+void recoverWorker( Shared * shared, Options * options, int worker ) {
+    WorkerSlot * slot = &shared->slots[worker];
+    Fuzzer       fuzzer;
+    Trial        trial;
+    char         why[WHY_SIZE] = "wlgen crashed";
+
+    initFuzzer( &fuzzer );
+    memset( &trial, 0, sizeof(trial) );
+    trial.a = slot->a;
+    trial.b = slot->b;
+    appendBytes( &fuzzer.source, slot->source, slot->sourceLength );
+    slot->programs++;
+    fail( &fuzzer, shared, options, slot->program, &trial, slot->optimized, why );
+    runWorker( shared, options, worker, slot->program + options->jobs );
+}
+
+pid_t startWorker( Shared * shared, Options * options, int worker, bool recovering ) {
+    pid_t child;
+    fflush( stdout );
+    child = fork();
+    if( child < 0 ) panicExit( "fork failed" );
+    if( child == 0 ) {
+        if( recovering ) recoverWorker( shared, options, worker );
+        runWorker( shared, options, worker, worker );
+    }
+    return child;
+}
+
+void report( Shared * shared, Options * options, double seconds ) {
+    long programs = 0, trials = 0, skipped = 0;
+    int  worker;
+    for( worker = 0; worker < options->jobs; worker++ ) {
+        programs += shared->slots[worker].programs;
+        trials   += shared->slots[worker].trials;
+        skipped  += shared->slots[worker].skipped;
+    }
+    printf( "%7.1f s %10ld programs %9.0f programs/s %11ld trials run %9ld skipped %5d failures\n",
+            seconds, programs, programs / (seconds > 0 ? seconds : 1e-9), trials, skipped, shared->failures );
+    fflush( stdout );
+}
+
+int main( int argc, char * argv[] ) {
+
+    Options     options = { 0, DEFAULT_SECONDS, 0, 0, 1, DEFAULT_OUT_DIR };
+    Shared    * shared;
+    pid_t       workers[MAX_JOBS];
+    int         running, worker, argi, status, zero;
+    double      start, lastReport;
+    bool        seeded  = false;
+
+    for( argi = 1; argi + 1 < argc; argi += 2 ) {
+        if( ! strcmp( argv[argi], "--jobs" ) )              options.jobs        = atoi( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--seconds" ) )      options.seconds     = atof( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--programs" ) )     options.programs    = atol( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--max-failures" ) ) options.maxFailures = atoi( argv[argi+1] );
+        else if( ! strcmp( argv[argi], "--out" ) )          options.outDir      = argv[argi+1];
+        else if( ! strcmp( argv[argi], "--seed" ) ) {
+            options.seed = strtoull( argv[argi+1], NULL, 10 );
+            seeded       = true;
+        } else break;
+    }
+    if( options.jobs == 0 ) options.jobs = (int) sysconf( _SC_NPROCESSORS_ONLN );
+    if( argi != argc || options.jobs <= 0 || options.jobs > MAX_JOBS || options.seconds < 0 || options.programs < 0
+        || options.maxFailures <= 0 ) {
+        fprintf( stderr, "usage: %s [--jobs N] [--seconds S] [--programs N] [--seed S] [--max-failures N] [--out DIR]\n", argv[0] );
+        return 1;
+    }
+    if( ! seeded ) options.seed = (uint64_t) time( NULL );
+
+    // Mapping /dev/zero shared is the POSIX way to get memory shared with the workers (MAP_ANONYMOUS isn't).
+    zero   = open( "/dev/zero", O_RDWR );
+    shared = zero < 0 ? MAP_FAILED : mmap( NULL, sizeof(Shared) + options.jobs * sizeof(WorkerSlot),
+                                           PROT_READ | PROT_WRITE, MAP_SHARED, zero, 0 );
+    if( shared == MAP_FAILED ) panicExit( "can't allocate shared memory" );
+    close( zero );
+
+    initGrammar();
+    printf( "wlfuzz --seed %llu --jobs %d\n", (unsigned long long) options.seed, options.jobs );
+    start = lastReport = wallClock();
+    for( worker = 0; worker < options.jobs; worker++ ) workers[worker] = startWorker( shared, &options, worker, false );
+
+    for( running = options.jobs; running > 0; ) {
+        pid_t child = waitpid( -1, &status, WNOHANG );
+        if( child == 0 ) {
+            struct timespec pause = { 0, 50000000 };
+            nanosleep( &pause, NULL );
+            if( options.seconds > 0 && wallClock() - start >= options.seconds ) shared->stop = true;
+            if( wallClock() - lastReport >= REPORT_INTERVAL ) {
+                report( shared, &options, wallClock() - start );
+                lastReport = wallClock();
+            }
+            continue;
+        }
+        if( child < 0 ) panicExit( "waitpid failed" );
+        for( worker = 0; worker < options.jobs && workers[worker] != child; worker++ );
+        if( worker == options.jobs ) continue;
+        if( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 ) {
+            running--;
+        } else if( WIFEXITED( status ) ) {
+            printf( "ERROR: worker %d stopped on program %ld\n", worker, shared->slots[worker].program );
+            running--;
+        } else {
+            printf( "worker %d crashed (signal %d) on program %ld\n", worker, WTERMSIG( status ), shared->slots[worker].program );
+            workers[worker] = startWorker( shared, &options, worker, true );
+        }
+    }
+    report( shared, &options, wallClock() - start );
+    return shared->failures > 0 ? 1 : 0;
+}
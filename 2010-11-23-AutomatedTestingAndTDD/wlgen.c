@@ -34,11 +34,23 @@
 //
 // -----------------------------------------------------------------------------------------------------
 
+#define _POSIX_C_SOURCE 200809L        // For mmap(...), fileno(...) and friends under -std=c99.
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdbool.h>
+#include <setjmp.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mipsasm.h"                   // To emit machine code directly (--mips).
 
 // Dmalloc (http://dmalloc.com) provides cover routines for memory management and string routines that
 // catch many ptr errors, array over/underwrites, and memory leaks. For information regarding the use of
@@ -55,87 +67,407 @@
 // Print debugging output if true.
 #define DEBUG false
 
+// -----------------------------------------------------------------------------------------------------
+//
+// Grammar symbols and rules.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Every grammar symbol and every production of the WL grammar is given a small integer id. The ids are
+// assigned once, when readParse(...) builds a node, so that passes two and three can dispatch on a node
+// with a switch statement instead of tokenizing and comparing literal rule strings.
+//
+// The lists below are "X-macros": each is expanded several times with different definitions of X(...) to
+// generate an enum and the matching table of strings, which keeps the two in sync.
+
+/* The set of terminal symbols in the WL grammar. */
+#define WL_TERMINALS(X) \
+    X(BOF)    X(BECOMES) X(COMMA)  X(ELSE)   X(EOF)     X(EQ)     X(GE)     X(GT)     X(ID)     X(IF) \
+    X(INT)    X(LBRACE)  X(LE)     X(LPAREN) X(LT)      X(MINUS)  X(NE)     X(NUM)    X(PCT)    X(PLUS) \
+    X(PRINTLN) X(RBRACE) X(RETURN) X(RPAREN) X(SEMI)    X(SLASH)  X(STAR)   X(WAIN)   X(WHILE)
+
+/* The set of non-terminal symbols in the WL grammar. */
+#define WL_NONTERMINALS(X) \
+    X(S)      X(procedure) X(dcls) X(dcl)    X(statements) X(statement) X(test) X(expr) X(term) X(factor) \
+    X(lvalue)
+
+/* The productions of the WL grammar, exactly as they appear in a *.wli file. */
+#define WL_RULES(X) \
+    X( S,                   "S BOF procedure EOF"                                                                   ) \
+    X( PROCEDURE,           "procedure INT WAIN LPAREN dcl COMMA dcl RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE" ) \
+    X( DCLS_EMPTY,          "dcls"                                                                                  ) \
+    X( DCLS,                "dcls dcls dcl BECOMES NUM SEMI"                                                        ) \
+    X( DCL,                 "dcl INT ID"                                                                            ) \
+    X( STATEMENTS_EMPTY,    "statements"                                                                            ) \
+    X( STATEMENTS,          "statements statements statement"                                                      ) \
+    X( STATEMENT_ASSIGN,    "statement lvalue BECOMES expr SEMI"                                                    ) \
+    X( STATEMENT_IF,        "statement IF LPAREN test RPAREN LBRACE statements RBRACE ELSE LBRACE statements RBRACE" ) \
+    X( STATEMENT_WHILE,     "statement WHILE LPAREN test RPAREN LBRACE statements RBRACE"                           ) \
+    X( STATEMENT_PRINTLN,   "statement PRINTLN LPAREN expr RPAREN SEMI"                                             ) \
+    X( TEST_EQ,             "test expr EQ expr"                                                                     ) \
+    X( TEST_NE,             "test expr NE expr"                                                                     ) \
+    X( TEST_LT,             "test expr LT expr"                                                                     ) \
+    X( TEST_LE,             "test expr LE expr"                                                                     ) \
+    X( TEST_GE,             "test expr GE expr"                                                                     ) \
+    X( TEST_GT,             "test expr GT expr"                                                                     ) \
+    X( EXPR_TERM,           "expr term"                                                                             ) \
+    X( EXPR_PLUS,           "expr expr PLUS term"                                                                   ) \
+    X( EXPR_MINUS,          "expr expr MINUS term"                                                                  ) \
+    X( TERM_FACTOR,         "term factor"                                                                           ) \
+    X( TERM_STAR,           "term term STAR factor"                                                                 ) \
+    X( TERM_SLASH,          "term term SLASH factor"                                                                ) \
+    X( TERM_PCT,            "term term PCT factor"                                                                  ) \
+    X( FACTOR_ID,           "factor ID"                                                                             ) \
+    X( FACTOR_NUM,          "factor NUM"                                                                            ) \
+    X( FACTOR_PARENS,       "factor LPAREN expr RPAREN"                                                             ) \
+    X( LVALUE_ID,           "lvalue ID"                                                                             ) \
+    X( LVALUE_PARENS,       "lvalue LPAREN lvalue RPAREN"                                                           )
+
+#define AS_SYMBOL_ID(name)          SYM_##name,
+#define AS_SYMBOL_NAME(name)        #name,
+#define AS_RULE_ID(name,text)       RULE_##name,
+#define AS_RULE_TEXT(name,text)     text,
+
+typedef enum {
+    WL_TERMINALS(AS_SYMBOL_ID)
+    WL_NONTERMINALS(AS_SYMBOL_ID)
+    NUM_SYMBOLS,
+    SYM_UNKNOWN = -1                             // A symbol that isn't part of the WL grammar.
+} SymbolId;
+
+#define NUM_TERMINALS SYM_S                      // Terminals come first, so S is the first non-terminal.
+
+typedef enum {
+    WL_RULES(AS_RULE_ID)
+    NUM_RULES,
+    RULE_TERMINAL = -1,                          // A leaf for a terminal symbol - eg { ID, foo }.
+    RULE_UNKNOWN  = -2,                          // A line of the *.wli file that isn't a production of WL.
+    RULE_CONSTANT = -3,                          // With -O, an expr, term or factor folded into a constant ...
+    RULE_BLOCK    = -4                           // ... and a statement replaced by the statements it runs, if any.
+} RuleId;
+
+char * symbolNames[] = { WL_TERMINALS(AS_SYMBOL_NAME) WL_NONTERMINALS(AS_SYMBOL_NAME) };
+char * ruleTexts[]   = { WL_RULES(AS_RULE_TEXT) };
+
+// The decoded form of a rule: rhs[0] ... rhs[rhsLength-1] are the symbols on the right hand side.
+#define MAX_RHS_LENGTH 14
+typedef struct Rule_ {
+    SymbolId lhs;
+    int      rhsLength;
+    SymbolId rhs[MAX_RHS_LENGTH];
+} Rule;
+
+Rule grammar[NUM_RULES];
+
+bool isTerminal( SymbolId sym ) {
+    return sym >= 0 && sym < NUM_TERMINALS;
+}
+
+// Two small open-addressing hash tables, filled in once by initGrammar(...): one maps the name of a grammar
+// symbol to its id; the other maps the sequence of symbols making up a rule to the id of that rule.
+// Each has a power-of-two number of slots comfortably larger than the number of entries.
+#define SYMBOL_SLOTS 128
+#define RULE_SLOTS   128
+
+SymbolId symbolSlots[SYMBOL_SLOTS];
+RuleId   ruleSlots[RULE_SLOTS];
+
+unsigned hashString( char * str, int length ) {
+    unsigned hash = 2166136261u;                 // FNV-1a.
+    int      idx;
+    for( idx = 0; idx < length; idx++ ) hash = (hash ^ (unsigned char) str[idx]) * 16777619u;
+    return hash;
+}
+
+unsigned hashSymbols( SymbolId lhs, SymbolId * rhs, int rhsLength ) {
+    unsigned hash = 2166136261u ^ (unsigned) lhs;
+    int      idx;
+    for( idx = 0; idx < rhsLength; idx++ ) hash = (hash * 16777619u) ^ (unsigned) rhs[idx];
+    return hash * 16777619u;
+}
+
+// Returns the id of the grammar symbol named by the length characters at name, or SYM_UNKNOWN.
+SymbolId symbolIdFor( char * name, int length ) {
+    unsigned slot = hashString( name, length ) & (SYMBOL_SLOTS - 1);
+    while( symbolSlots[slot] != SYM_UNKNOWN ) {
+        char * candidate = symbolNames[symbolSlots[slot]];
+        if( ! strncmp( candidate, name, length ) && candidate[length] == '\0' ) return symbolSlots[slot];
+        slot = (slot + 1) & (SYMBOL_SLOTS - 1);
+    }
+    return SYM_UNKNOWN;
+}
+
+// Returns the id of the rule lhs --> rhs[0] ... rhs[rhsLength-1], or RULE_UNKNOWN.
+RuleId ruleIdFor( SymbolId lhs, SymbolId * rhs, int rhsLength ) {
+    unsigned slot = hashSymbols( lhs, rhs, rhsLength ) & (RULE_SLOTS - 1);
+    while( ruleSlots[slot] != RULE_UNKNOWN ) {
+        Rule * rule = &grammar[ruleSlots[slot]];
+        if( rule->lhs == lhs && rule->rhsLength == rhsLength
+            && ! memcmp( rule->rhs, rhs, rhsLength * sizeof(SymbolId) ) ) return ruleSlots[slot];
+        slot = (slot + 1) & (RULE_SLOTS - 1);
+    }
+    return RULE_UNKNOWN;
+}
+
+// Decode the rule strings in ruleTexts[] and fill in the hash tables. Must be called before readParse(...).
+void initGrammar( void ) {
+    int      idx;
+    unsigned slot;
+
+    for( slot = 0; slot < SYMBOL_SLOTS; slot++ ) symbolSlots[slot] = SYM_UNKNOWN;
+    for( slot = 0; slot < RULE_SLOTS;   slot++ ) ruleSlots[slot]   = RULE_UNKNOWN;
+
+    for( idx = 0; idx < NUM_SYMBOLS; idx++ ) {
+        slot = hashString( symbolNames[idx], strlen(symbolNames[idx]) ) & (SYMBOL_SLOTS - 1);
+        while( symbolSlots[slot] != SYM_UNKNOWN ) slot = (slot + 1) & (SYMBOL_SLOTS - 1);
+        symbolSlots[slot] = idx;
+    }
+
+    for( idx = 0; idx < NUM_RULES; idx++ ) {
+        char   text[256];
+        char * nextToken;
+        Rule * rule = &grammar[idx];
+
+        strcpy( text, ruleTexts[idx] );          // strtok(...) is destructive, so tokenize a copy.
+        nextToken       = strtok( text, " " );
+        rule->lhs       = symbolIdFor( nextToken, strlen(nextToken) );
+        rule->rhsLength = 0;
+        while( (nextToken = strtok( NULL, " " )) ) {
+            rule->rhs[rule->rhsLength++] = symbolIdFor( nextToken, strlen(nextToken) );
+        }
+
+        slot = hashSymbols( rule->lhs, rule->rhs, rule->rhsLength ) & (RULE_SLOTS - 1);
+        while( ruleSlots[slot] != RULE_UNKNOWN ) slot = (slot + 1) & (RULE_SLOTS - 1);
+        ruleSlots[slot] = idx;
+    }
+}
+
 // -----------------------------------------------------------------------------------------------------
 //
 // Prototypes.
 //
 // -----------------------------------------------------------------------------------------------------
 
-typedef struct StringPtrArray_ * StringPtrArrayPtr;
+typedef struct SymbolTable_    * SymbolTablePtr;
 typedef struct Tree_           * TreePtr;
+typedef struct ParseTree_      * ParseTreePtr;
+typedef struct Emitter_        * EmitterPtr;
 
-void bail(                StringPtrArrayPtr rule );    // Reports a failure in pass 1 or 2 to match a rule. Should never happen.
-void panicExit(           char            * rule );    // Report a more general disaster and exit the program, reporting a non-zero status code.
+void reportError(         char * format, ...               );    // Report an error: see "Misc helpers" below.
+void bail(                ParseTreePtr parse, TreePtr tree );    // Reports a failure in pass 1 or 2 to match a rule. Should never happen.
+void panicExit(           char            * rule );              // Report a more general disaster.
 
-void printStringPtrArray( StringPtrArrayPtr spa  );    // For debugging only.
-void printTreeNode(       TreePtr           tree );    // For debugging only.
-void printTree(           TreePtr           tree );    // For debugging only.
+#define ERROR_MESSAGE_SIZE 1024
+jmp_buf * errorRecovery = NULL;                                  // Where reportError(...) returns to, when set.
+char      errorMessage[ERROR_MESSAGE_SIZE];                      // The most recent error reported.
 
-int                 main(              int argc, char * argv[]                     );
-TreePtr             readParse(         char * grammarSymbol                        );    // Pass one.
-StringPtrArrayPtr   symbolsDeclaredIn( TreePtr tree                                );    // Pass two.
-char              * generateCodeFor(   TreePtr tree, StringPtrArrayPtr symbolTable );    // Pass three.
+void * countedMalloc(     size_t bytes );                       // malloc(...), calloc(...) and realloc(...), counting the
+void * countedCalloc(     size_t count, size_t size );          // allocations made by each pass for --stats.
+void * countedRealloc(    void * ptr, size_t bytes );
+
+void printSymbolTable(    SymbolTablePtr table );                // For debugging only.
+void formatRule(          ParseTreePtr parse, TreePtr tree, char * buffer, size_t size );    // For error messages.
+void printRule(           ParseTreePtr parse, TreePtr tree );    // For debugging only.
+void printTreeNode(       ParseTreePtr parse, TreePtr tree );    // For debugging only.
+void printTree(           ParseTreePtr parse, TreePtr tree );    // For debugging only.
+
+int                 main(              int argc, char * argv[]                                         );
+bool                compile(           int fd, FILE * sink                                             );
+void                assemble(          EmitterPtr program, FILE * sink                                 );
+void                readParse(         ParseTreePtr parse, int fd                                      );    // Pass one.
+bool                readBinaryParse(   ParseTreePtr parse                                              );    // Pass one, for a *.wlb file.
+void                writeBinaryParse(  ParseTreePtr parse, EmitterPtr out                              );    // With --emit-wlb, instead of passes two and three.
+bool                parseSource(       ParseTreePtr parse                                              );    // Pass one, for a *.wl file.
+void                writeTextParse(    ParseTreePtr parse, EmitterPtr out                              );    // With --emit-wli, instead of passes two and three.
+void                symbolsDeclaredIn( ParseTreePtr parse, TreePtr tree, SymbolTablePtr symbolTable  );    // Pass two.
+void                optimizeTree(      ParseTreePtr parse, TreePtr tree, SymbolTablePtr symbolTable  );    // Between passes two and three, with -O.
+void                generateCodeFor(   ParseTreePtr parse, TreePtr tree, SymbolTablePtr symbolTable, EmitterPtr out );    // Pass three.
+void                allocateRegisters( ParseTreePtr parse, TreePtr procedure, SymbolTablePtr symbolTable   );    // Pass three, with -O.
+long                peephole(          EmitterPtr program                                              );    // Pass three, with -O.
 
 // -----------------------------------------------------------------------------------------------------
 //
-// Terminal symbols.
+// The symbol table.
 //
 // -----------------------------------------------------------------------------------------------------
 
-/* The set of terminal symbols in the WL grammar. */
-char * terminals[] = { "BOF", "BECOMES", "COMMA", "ELSE", "EOF", "EQ", "GE",
-    "GT", "ID", "IF", "INT", "LBRACE", "LE", "LPAREN", "LT", "MINUS", "NE",
-    "NUM", "PCT", "PLUS", "PRINTLN", "RBRACE", "RETURN", "RPAREN", "SEMI",
-    "SLASH", "STAR", "WAIN", "WHILE" };
+// The symbol table maps the name of each variable declared in the program to its type and to its offset
+// in wain's stack frame. It is an open-addressing hash table (with linear probing) whose capacity is a power
+// of two that is kept at least twice the number of symbols, so lookups take O(1) time however many variables
+// are declared. Names are not copied: like lexemes, they are slices of the input text.
+//
+// Frame layout: $29 points at the first parameter. The variables are stored in the order they are declared
+// - the two parameters of wain first, then the dcls - at offsets 0, -4, -8, ... from $29.
 
-bool isTerminal( char *sym ) {
-    int idx;
-    for( idx=0; idx < sizeof(terminals)/sizeof(char*); idx++ )
-        if( ! strcmp(terminals[idx],sym) ) return 1;
-    return 0;
+#define INITIAL_SYMBOL_SLOTS 64
+
+typedef struct Symbol_ {
+    char     * name;                  // NOT '\0'-terminated; NULL for an empty slot.
+    int        length;
+    SymbolId   type;                  // The only type in WL is INT.
+    int        offset;                // Where the variable lives, relative to $29.
+    int        value;                 // The initial value of a dcl.
+    int        reg;                   // With -O, the register holding the variable, or 0 if it lives in the frame ...
+    int        liveStart, liveEnd;    // ... the points between which it is live ...
+    int        initBefore;            // ... and the top-level statement before which its register is loaded.
+    int        reads;                 // With -O, the # of times its value is read - see optimizeTree(...).
+} Symbol;
+
+#define NOT_LIVE           (-1)       // For .liveStart and .liveEnd, until the variable is used.
+#define INIT_IN_PROLOGUE   (-1)       // For .initBefore of the parameters.
+
+typedef struct SymbolTable_ {
+    Symbol   * slots;
+    int        capacity;              // # of slots - always a power of two.
+    int        nSymbols;
+    bool       usesPrintln;           // Whether the program contains a println statement.
+    Symbol  ** live;                  // With -O, the variables that are used, by the start of their live intervals ...
+    int        nLive;                 // ... and how many there are. See allocateRegisters(...).
+} SymbolTable;
+
+SymbolTable * newSymbolTable( void ) {
+    SymbolTable * table = countedMalloc( sizeof(SymbolTable) );
+    if( table == NULL ) panicExit( "out of memory" );
+    table->capacity    = INITIAL_SYMBOL_SLOTS;
+    table->nSymbols    = 0;
+    table->usesPrintln = false;
+    table->live        = NULL;
+    table->nLive       = 0;
+    table->slots       = countedCalloc( table->capacity, sizeof(Symbol) );
+    if( table->slots == NULL ) panicExit( "out of memory" );
+    return table;
+}
+
+void freeSymbolTable( SymbolTable * table ) {
+    free( table->live  );
+    free( table->slots );
+    free( table        );
+}
+
+// Returns the slot for name: either the one holding it or the empty one where it belongs.
+Symbol * findSlot( SymbolTable * table, char * name, int length ) {
+    unsigned slot = hashString( name, length ) & (table->capacity - 1);
+    while( table->slots[slot].name != NULL ) {
+        Symbol * sym = &table->slots[slot];
+        if( sym->length == length && ! memcmp( sym->name, name, length ) ) break;
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return &table->slots[slot];
+}
+
+// Returns the symbol for the variable name, or NULL if it hasn't been declared.
+Symbol * lookupSymbol( SymbolTable * table, char * name, int length ) {
+    Symbol * sym = findSlot( table, name, length );
+    return sym->name != NULL ? sym : NULL;
+}
+
+// Double the number of slots, rehashing every symbol.
+void growSymbolTable( SymbolTable * table ) {
+    Symbol * oldSlots    = table->slots;
+    int      oldCapacity = table->capacity;
+    int      idx;
+
+    table->capacity *= 2;
+    table->slots     = countedCalloc( table->capacity, sizeof(Symbol) );
+    if( table->slots == NULL ) panicExit( "out of memory" );
+    for( idx = 0; idx < oldCapacity; idx++ ) {
+        if( oldSlots[idx].name != NULL ) {
+            *findSlot( table, oldSlots[idx].name, oldSlots[idx].length ) = oldSlots[idx];
+        }
+    }
+    free( oldSlots );
+}
+
+// Declare the variable name, giving it the next free slot in the frame. Returns NULL if it's already declared.
+Symbol * declareSymbol( SymbolTable * table, char * name, int length, SymbolId type ) {
+    Symbol * sym;
+
+    if( 2 * (table->nSymbols + 1) > table->capacity ) growSymbolTable( table );
+    sym = findSlot( table, name, length );
+    if( sym->name != NULL ) return NULL;
+    sym->name   = name;
+    sym->length = length;
+    sym->type   = type;
+    sym->offset = -4 * table->nSymbols;
+    table->nSymbols++;
+    return sym;
 }
 
 // -----------------------------------------------------------------------------------------------------
 //
-// Support for a simple-minded proto-symbol table.
+// A bump ("arena") allocator.
 //
 // -----------------------------------------------------------------------------------------------------
 
-// The elements in an array are (*ptrArray)[0] ... (*ptrArray)[size-1].
-typedef struct StringPtrArray_ {
-    int    size;           // # of pointers in the array.
-    char * (*ptrArray)[];  // ptrArray is a pointer to an array of pointers to C-strings (char*'s).
-} StringPtrArray;
+// An arena hands out memory by bumping a pointer through a large block, starting a new (twice as large)
+// block when the current one fills up. Individual allocations are never freed; instead everything allocated
+// from an arena is released at once by arenaRelease(...). The parse tree lives entirely in one arena, so
+// building it costs a handful of mallocs no matter how many nodes it has, and tearing it down is one call.
 
-// Appends the pointers in the second array to the first array and deallocates the second.
-// Doing so requires enlarging the memory block allocated to hold the array.
-void stringArrayAppend( StringPtrArray * this, StringPtrArray * other ) {
+#define ARENA_BLOCK_SIZE (64 * 1024)
 
-    int idx;
+typedef struct ArenaBlock_ {
+    struct ArenaBlock_ * next;        // The previously filled block, if any.
+    size_t               size;        // # of bytes in data[].
+    size_t               used;        // # of bytes of data[] handed out so far.
+    char                 data[];
+} ArenaBlock;
+
+typedef struct Arena_ {
+    ArenaBlock * blocks;              // The block currently being carved up; older blocks hang off .next.
+} Arena;
+
+// Round a request up so that every allocation is suitably aligned for any type we store in an arena.
+size_t arenaRound( size_t bytes ) {
+    return (bytes + 7) & ~(size_t) 7;
+}
 
-    // Expand the space allocated for this->ptrArray sufficiently to hold the contents of other.
-    // This may, or may not, required releasing the original block and allocating a new, larger one.
-    // In the latter case, realloc copies the contents of the old block to the beginning of the new block.
-    this->ptrArray = realloc( this->ptrArray, (this->size + other->size) * sizeof(char*) );
+void * arenaAlloc( Arena * arena, size_t bytes ) {
+    ArenaBlock * block = arena->blocks;
+    void       * ptr;
 
-    // Append the elements of other->ptrArray to the end of this->ptrArray.
-    for( idx = 0; idx < other->size; idx++ ) {
-        (*(this->ptrArray))[this->size + idx] = (*other->ptrArray)[idx];
+    bytes = arenaRound( bytes );
+    if( block == NULL || block->used + bytes > block->size ) {
+        size_t size = block ? 2 * block->size : ARENA_BLOCK_SIZE;
+        if( size < bytes ) size = bytes;
+        block = countedMalloc( sizeof(ArenaBlock) + size );
+        if( block == NULL ) panicExit( "out of memory" );
+        block->next   = arena->blocks;
+        block->size   = size;
+        block->used   = 0;
+        arena->blocks = block;
     }
+    ptr          = block->data + block->used;
+    block->used += bytes;
+    return ptr;
+}
 
-    this->size += other->size;
+// Grow an array previously allocated from arena. If it was the last thing allocated from the current block
+// and there's room, it is simply extended in place; otherwise it is copied to a fresh allocation (the old
+// copy is reclaimed along with everything else when the arena is released).
+void * arenaGrow( Arena * arena, void * old, size_t oldBytes, size_t newBytes ) {
+    ArenaBlock * block = arena->blocks;
+    void       * ptr;
 
-    free( other->ptrArray );
-    free( other           );      // [JCB - memory leak fixed.]
+    if( old != NULL && block != NULL
+        && (char*) old + arenaRound(oldBytes) == block->data + block->used
+        && (size_t) ((char*) old - block->data) + arenaRound(newBytes) <= block->size ) {
+        block->used = (size_t) ((char*) old - block->data) + arenaRound( newBytes );
+        return old;
+    }
+    ptr = arenaAlloc( arena, newBytes );
+    if( old != NULL ) memcpy( ptr, old, oldBytes );
+    return ptr;
 }
 
-void freeStringPtrArray( StringPtrArray *  strs ) {
-    int idx;
-    for( idx = 0; idx < strs->size; idx++ ) {
-        free( (*strs->ptrArray)[idx] );
+void arenaRelease( Arena * arena ) {
+    ArenaBlock * block = arena->blocks;
+    while( block != NULL ) {
+        ArenaBlock * next = block->next;
+        free( block );
+        block = next;
     }
-    free( strs->ptrArray );
-    free( strs           );
+    arena->blocks = NULL;
 }
 
 // -----------------------------------------------------------------------------------------------------
@@ -147,337 +479,3007 @@ void freeStringPtrArray( StringPtrArray *  strs ) {
 // Data structure for representing the parse tree. Abstractly, leaves are terminals & internal nodes are
 // non-terminals. However, in the data structure used here epsilon rules break this abstraction.
 // In particular, the node for the lhs of an epsilon rule is, of course, a non-terminal but the node
-// has no children (ie .nChildren == 0 and .children == NULL). In other words, we do not explicitly
-// represent epsilon by a node in the tree.
+// has no children (ie .nChildren == 0). In other words, we do not explicitly represent epsilon by a node
+// in the tree.
 //
-// Details: (1) leaves of the tree have nChildren == 0, but rule has TWO elements, the second of which is the
-// string scanned that was recognized as an instance of this terminal symbol.
+// Details: (1) the whole tree is stored in a ParseTree: one contiguous array of Tree nodes, allocated from
+// the ParseTree's arena, plus the text of the *.wli file it was read from. Node 0 is the root.
 //
-// (2) A Tree struct has a fixed size (for most compilers, 12 bytes). In particular, the .children field
-// is a pointer. For leaves it will be NULL; for internal nodes it will point to a block of heap memory
-// containing an array of pointers to other tree nodes.
+// (2) The children of a node occupy consecutive slots of the node array: child idx of tree is
+// nodes[tree->firstChild + idx] (use childOf(...)). The slots are reserved when the parent's line is read,
+// so a node's children always sit together even though their own subtrees are read later.
 //
 // (3) A leaf corresponds EITHER to a terminal node OR to a non-terminal which is the LHS of an epsilon rule
 // (which has no children).
 //
-// (4) One weirdness: for terminals the rule field consists not just of the terminal symbol, but has the form
-// { <terminal>, <lexemeForTerminal> } - eg { INT, int } or { ID, foo } or { NUM, 42 } or { WAIN, wain } -
-// because for some terminals (ie INT and ID) you must retain the originating lexical string somewhere,
-// and this is as good a place as any.
+// (4) For terminals .lexeme and .lexemeLength give the offset and length in the input text of the string
+// scanned that was recognized as an instance of the terminal - eg "int" for INT, "foo" for ID, "42" for NUM
+// (use lexemeOf(...)) - because for some terminals (ie INT and ID) you must retain the originating lexical
+// string somewhere. The lexeme is a slice of the input, NOT a '\0'-terminated string. For a line of the
+// *.wli file that isn't a rule of WL, the lexeme is the whole line so that it can be reported. Otherwise
+// .lexeme is NO_LEXEME.
+//
+// (5) readParse(...) looks each line up once in the grammar tables and records the id of the matching
+// production in .ruleId (RULE_TERMINAL for leaves, RULE_UNKNOWN if the line isn't part of WL) and the id of
+// the LHS in .symbol. Checking what kind of node we have is then a single integer comparison.
 //
-// (5) The primary use for .rule is to compare it against the literal representation of a rule as a string
-// -- eg "S BOF procedure EOF" -- in passTwo(...) or passThree(...). At first blush it therefore seems perverse
-// and inefficient to represent rule as a list of token strings -- eg { "S", "BOF", "procedure", "EOF" } --
-// as we then have to repeatedly tokenize the rule literals to compare them with values of .rule. Arguably,
-// however, doing so makes the compiler a bit more robust in that it doesn't care how much whitespace exists
-// between the tokens in such literal rule strings. And the programs we compile are generally small enough
-// that the additional overhead can be forgiven.
+// (6) With -O, optimizeTree(...) rewrites some nodes in place: see RULE_CONSTANT and RULE_BLOCK.
+
+#define NO_LEXEME (-1)
 
 typedef struct Tree_ {
-    StringPtrArray * rule;            // Entry [0] is the LHS; entries [1] ... [nChildren] are the RHS.
-    int              nChildren;
-    struct Tree_   * (*children)[];   // children is a pointer to an ARRAY of pointers to (other) Tree structs.
+    RuleId    ruleId;                 // Which production of WL this node was built from.
+    SymbolId  symbol;                 // The grammar symbol on the LHS of that production (or the terminal).
+    int       nChildren;
+    int       firstChild;             // Index in the node array of child 0; the others follow it.
+    int       lexeme;                 // Offset in the input text of this node's lexeme, or NO_LEXEME.
+    int       lexemeLength;
 } Tree;
 
-void freeTree( TreePtr tree ) {
-    int idx;
-    freeStringPtrArray( tree->rule );
-    if( tree->nChildren > 0 ) {
-        for( idx=0; idx < tree->nChildren; idx++ ) {
-            freeTree( (*tree->children)[idx] );
-        }
-        free( tree->children );
-    }
-    free( tree );
-}
-
-// Divide a string into a sequence of tokens.
-// Warning: strtok(...) modifies the string it's scanning; see man 3 strtok for details.
-// Applied to lines read from the *.wli filee supplied as input to the compiler.
-StringPtrArray * tokenize( char * line ) {
-    char           * nextToken;
-    StringPtrArray * tokens = malloc( sizeof(StringPtrArray) );
-    tokens->size            = 0;
-    tokens->ptrArray        = NULL;
-    tokens->ptrArray        = malloc( strlen(line) * sizeof(char*) );                  // # of tokens in line <= strlen(line)
-    nextToken = strtok( line, " \n" );
-    do {
-        (*tokens->ptrArray)[tokens->size] = (char*) malloc( strlen(nextToken) + 1 );   // +1 for the terminating '\0'
-        strcpy( (*tokens->ptrArray)[tokens->size], nextToken );
-        tokens->size++;
-    } while( (nextToken = strtok(NULL," \n")) );
-    return tokens;
-}
-
-/* Does this node's rule match otherRule? */
-bool doesTreeNodeMatchRule( TreePtr tree, char * otherRule ) {
-
-    int    result     = true;
-    char * copyOfRule = (char*) malloc( strlen(otherRule) + 1  );
-
-    // Tokenize a COPY of otherRule because strtok(...) is destructive. If we did not make a copy first,
-    // we would be changing the actual value of a literal string in symbolsDeclaredIn(...) or genCode(...)!
-    StringPtrArray * tokens;
-    strcpy( copyOfRule, otherRule );
-    tokens = tokenize( copyOfRule );
-
-    if( tree->rule->size != tokens->size ) { 
-        result = false;
+typedef struct ParseTree_ {
+    Arena     arena;                  // The nodes are allocated from here.
+    Tree    * nodes;                  // nodes[0] is the root.
+    int       nNodes;
+    int       maxNodes;
+    char    * text;                   // The *.wli file the tree was read from; lexemes point into it.
+    size_t    textLength;
+    bool      textMapped;             // Whether text was mmap'ed (rather than read into a malloc'ed buffer).
+    int     * work;                   // The work stack - see pushWork(...) below.
+    int       nWork;
+    int       maxWork;
+} ParseTree;
+
+TreePtr childOf( ParseTree * parse, TreePtr tree, int idx ) {
+    return &parse->nodes[tree->firstChild + idx];
+}
+
+// The first character of tree's lexeme, which is tree->lexemeLength characters long.
+char * lexemeOf( ParseTree * parse, TreePtr tree ) {
+    return &parse->text[tree->lexeme];
+}
+
+// Reserve count consecutive nodes and return the index of the first.
+int allocNodes( ParseTree * parse, int count ) {
+    int first = parse->nNodes;
+    if( parse->nNodes + count > parse->maxNodes ) {
+        int maxNodes = 2 * parse->maxNodes;
+        if( maxNodes < parse->nNodes + count ) maxNodes = parse->nNodes + count;
+        parse->nodes    = arenaGrow( &parse->arena, parse->nodes,
+                                     parse->maxNodes * sizeof(Tree), maxNodes * sizeof(Tree) );
+        parse->maxNodes = maxNodes;
+    }
+    parse->nNodes += count;
+    return first;
+}
+
+ParseTree * newParseTree( void ) {
+    Arena       arena = { NULL };
+    ParseTree * parse = arenaAlloc( &arena, sizeof(ParseTree) );    // The ParseTree lives in its own arena.
+    memset( parse, 0, sizeof(ParseTree) );
+    parse->arena = arena;
+    return parse;
+}
+
+// Releases the tree and everything in it - including the ParseTree struct itself - in one go.
+void freeParseTree( ParseTree * parse ) {
+    Arena arena = parse->arena;
+    if( parse->textMapped ) {
+        munmap( parse->text, parse->textLength );
     } else {
-        int idx;
-        for( idx=0; idx < tree->rule->size; idx++ ) {
-            if( strcmp( (*tree->rule->ptrArray)[idx], (*tokens->ptrArray)[idx]) ) {
-                result = false;
-                break;
-            }
-        }
-    }   
+        free( parse->text );
+    }
+    arenaRelease( &arena );
+}
+
+// The work stack is scratch space for walking the tree without recursing once per node: pass one keeps the
+// nodes whose lines have yet to be read on it, and passes two and three use it to walk left-recursive lists.
+void pushWork( ParseTree * parse, TreePtr tree ) {
+    if( parse->nWork == parse->maxWork ) {
+        int maxWork = parse->maxWork ? 2 * parse->maxWork : 1024;
+        parse->work    = arenaGrow( &parse->arena, parse->work, parse->maxWork * sizeof(int), maxWork * sizeof(int) );
+        parse->maxWork = maxWork;
+    }
+    parse->work[parse->nWork++] = tree - parse->nodes;
+}
 
-    freeStringPtrArray( tokens );
-    free( copyOfRule );
-    return result;
+TreePtr popWork( ParseTree * parse ) {
+    return &parse->nodes[parse->work[--parse->nWork]];
+}
+
+// Many WL constructs are left-recursive lists - eg statements --> statements statement, or expr --> expr PLUS
+// term - whose trees lean to the left, one level per element. Walking them by recursion would use a C stack
+// frame per element, so instead pushLeftSpine(...) follows the first child down from tree for as long as it is
+// an instance of the same symbol, pushing each node it passes on the work stack, and returns the node at the
+// bottom (eg the "statements" of the eps-rule, or the "expr term" node). Popping the pushed nodes then visits
+// the elements of the list in source order.
+TreePtr pushLeftSpine( ParseTree * parse, TreePtr tree ) {
+    while( tree->nChildren >= 2 && childOf(parse,tree,0)->symbol == tree->symbol ) {
+        pushWork( parse, tree );
+        tree = childOf( parse, tree, 0 );
+    }
+    return tree;
+}
+
+// The leftmost operand of an expr or term, given the bottom of its left spine - eg the term of expr --> term.
+// With -O the bottom may have been folded into a constant itself (see optimizeTree(...)).
+TreePtr leftmostOperand( ParseTree * parse, TreePtr bottom ) {
+    return bottom->ruleId == RULE_CONSTANT ? bottom : childOf( parse, bottom, 0 );
+}
+
+// The value of a RULE_CONSTANT node, which is kept in place of its lexeme.
+int constantOf( TreePtr tree ) {
+    return tree->lexeme;
 }
 
 // -----------------------------------------------------------------------------------------------------
 //
-// Main.
+// Emitting the generated code.
 //
 // -----------------------------------------------------------------------------------------------------
 
-int main( int argc, char * argv[] ) {
+// Every case of generateCodeFor(...) appends its instructions to an Emitter rather than building and
+// returning a string, so the cost of producing the program is linear in its size. When the Emitter has a
+// sink, the buffer is written to the sink with fwrite(...) each time it fills up, so code is streamed out
+// while the tree is still being walked and the whole program never has to be held in memory at once.
+// Without a sink the buffer simply grows to hold everything emitted.
+//
+// The output is copied verbatim - it is never used as a printf format - so a '%' in it is harmless.
 
-    Tree           * parseTree;    // Reconstructed from a *.wli file.
-    StringPtrArray * symbols;      // The symbol table.
-    char           * program;      // An assembly language equivalent to the WL program being compiled.
+#define EMITTER_BUFFER_SIZE (64 * 1024)
 
-    #if defined(IDE) && defined(DMALLOC)
-        // 1st param - one of: DMALLOC_runtimeFor241, DMALLOC_lowFor241, DMALLOC_mediumFor241, DMALLOC_highFor241.
-        // 2nd param - most useful possibilities are: print-messages, log=logfile, inter=100, and log-trans
-        //             (logs all calls to dmalloc cover routines). Separate these tokens by commas when you
-        //             want to supply more than one - eg "print-messages,inter=10".
-        dmalloc_setup( DMALLOC_highFor241, "print-messages" );
-    #endif
+typedef struct Emitter_ {
+    char   * buffer;
+    size_t   length;                  // # of bytes of buffer[] in use.
+    size_t   capacity;
+    FILE   * sink;                    // Where to flush the buffer to; NULL to keep everything in buffer[].
+    size_t   bytesEmitted;            // Total # of bytes emitted, including any already flushed.
+    int      nLabels;                 // # of labels generated so far; used to number them uniquely.
+} Emitter;
 
-    // argv[0] is always the name of the program being run.
-    // argv[1], when present, is assumed to be a path to an input wli file.
-    if( argc == 2 ) {
-        if( DEBUG ) fprintf( stderr, "argv[0] = %s\nargv[1] = %s\n", argv[0], argv[1] );
-        // Unfortunately we can't just assign a newly opened file pointer to stdin on Solaris, so we do it this way...
-        FILE * fp = fopen( argv[1], "r" );
-        if( fp == NULL ) panicExit( "can't open the specified input file" );
-        int fd = fileno(fp);
-        if( dup2(fd,STDIN_FILENO) ) panicExit( "failed to replace stdin by the specified input file" );
-        close(fd);
-    };
+Emitter * newEmitter( FILE * sink ) {
+    Emitter * out = countedMalloc( sizeof(Emitter) );
+    if( out == NULL ) panicExit( "out of memory" );
+    out->buffer       = countedMalloc( EMITTER_BUFFER_SIZE );
+    out->length       = 0;
+    out->capacity     = EMITTER_BUFFER_SIZE;
+    out->sink         = sink;
+    out->bytesEmitted = 0;
+    out->nLabels      = 0;
+    if( out->buffer == NULL ) {
+        free( out );
+        panicExit( "out of memory" );
+    }
+    return out;
+}
 
-    parseTree = readParse( "S" );                         // Read a *.wli input file, (re)building the program's parse tree.
-    if( DEBUG )  {
-        fputc( '\n', stderr );
-        printTree( parseTree );
-        fputc( '\n', stderr );
+void flushEmitter( Emitter * out ) {
+    if( out->sink != NULL && out->length > 0 ) {
+        if( fwrite( out->buffer, 1, out->length, out->sink ) != out->length ) panicExit( "failed to write the output" );
+        out->length = 0;
     }
-    symbols   = symbolsDeclaredIn( parseTree );           // Walk the tree, building a list of the variables declared in it.
-    program   = generateCodeFor( parseTree, symbols );    // Walk the parse tree, generating code. [JCB - memory leak fixed.]
-    printf( program );
+}
 
-    free( program );
-    freeTree( parseTree );
-    freeStringPtrArray( symbols );
+// Discards anything not yet flushed - call flushEmitter(...) first to keep it.
+void freeEmitter( Emitter * out ) {
+    free( out->buffer );
+    free( out         );
+}
 
-    #if defined(DMALLOC) && false
-        // Actually dmalloc_shutdown(...) is called automatically at exit. But sometimes when debugging it's
-        // useful to dump the list of unfreed memory *before* exiting so we can poke around with a debugger.
-        dmalloc_shutdown();
-    #endif
+// Make room for at least bytes more bytes in out's buffer, by flushing it or by growing it.
+void reserveEmitter( Emitter * out, size_t bytes ) {
+    if( out->length + bytes <= out->capacity ) return;
+    flushEmitter( out );
+    if( out->length + bytes > out->capacity ) {
+        while( out->length + bytes > out->capacity ) out->capacity *= 2;
+        out->buffer = countedRealloc( out->buffer, out->capacity );
+        if( out->buffer == NULL ) panicExit( "out of memory" );
+    }
+}
+
+void emitBytes( Emitter * out, char * bytes, size_t length ) {
+    reserveEmitter( out, length );
+    memcpy( out->buffer + out->length, bytes, length );
+    out->length       += length;
+    out->bytesEmitted += length;
+}
 
-    fclose( stdin );
-    return 0;
+void emitString( Emitter * out, char * str ) {
+    emitBytes( out, str, strlen(str) );
+}
+
+// Append printf-style formatted text - eg emit( out, "lw $3,%d($29)\n", offset ).
+void emit( Emitter * out, char * format, ... ) {
+    va_list args;
+    int     length;
+
+    va_start( args, format );
+    length = vsnprintf( out->buffer + out->length, out->capacity - out->length, format, args );
+    va_end( args );
+    if( length < 0 ) panicExit( "failed to format the output" );
+
+    if( out->length + length >= out->capacity ) {      // Didn't fit (vsnprintf also needs room for a '\0').
+        reserveEmitter( out, length + 1 );
+        va_start( args, format );
+        vsnprintf( out->buffer + out->length, out->capacity - out->length, format, args );
+        va_end( args );
+    }
+    out->length       += length;
+    out->bytesEmitted += length;
 }
 
 // -----------------------------------------------------------------------------------------------------
 //
-// Pass one - building the parse tree.
+// Statistics (--stats).
 //
 // -----------------------------------------------------------------------------------------------------
 
-// Read a *.wli file, reconstructing and returning the program's parse tree.
-TreePtr readParse( char * grammarSymbol ) {
+// compile(...) gathers these as it goes; with --stats they are reported on stderr after each program is
+// compiled, either as text or (with --stats=json) as one line of JSON, so that a test harness can track
+// the compiler's performance over time. Every heap allocation made by the passes goes through
+// countedMalloc(...) and friends, which charge it to the pass in progress.
+
+typedef enum { PASS_READ_PARSE, PASS_SYMBOLS, PASS_OPTIMIZE, PASS_GENERATE, NUM_PASSES, NO_PASS = -1 } Pass;
+
+typedef enum { STATS_NONE, STATS_TEXT, STATS_JSON } StatsFormat;
+
+typedef struct Stats_ {
+    double   seconds[NUM_PASSES];         // Wall time.
+    long     allocations[NUM_PASSES];     // # of malloc/calloc/realloc calls ...
+    size_t   allocatedBytes[NUM_PASSES];  // ... and the # of bytes they asked for.
+    int      nNodes;                      // In the parse tree.
+    int      maxDepth;                    // Of the parse tree; the root is at depth 0.
+    long     ruleMatches;                 // # of times pass one looked up a rule for a line of the input.
+    size_t   outputBytes;                 // Of assembly language or (with --mips) machine code.
+    long     peepholeRemoved;             // With -O, # of instructions the peephole optimizer removed.
+} Stats;
+
+char        * passNames[NUM_PASSES] = { "readParse", "symbolsDeclaredIn", "optimizeTree", "generateCodeFor" };
+Stats         stats;
+int           currentPass = NO_PASS;
+double        passStarted;
+
+double wallClock( void ) {
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void startPass( Pass pass ) {
+    currentPass = pass;
+    passStarted = wallClock();
+}
+
+void endPass( void ) {
+    stats.seconds[currentPass] = wallClock() - passStarted;
+    currentPass = NO_PASS;
+}
+
+void countAllocation( size_t bytes ) {
+    if( currentPass == NO_PASS ) return;
+    stats.allocations[currentPass]++;
+    stats.allocatedBytes[currentPass] += bytes;
+}
+
+void * countedMalloc( size_t bytes ) {
+    countAllocation( bytes );
+    return malloc( bytes );
+}
+
+void * countedCalloc( size_t count, size_t size ) {
+    countAllocation( count * size );
+    return calloc( count, size );
+}
+
+void * countedRealloc( void * ptr, size_t bytes ) {
+    countAllocation( bytes );
+    return realloc( ptr, bytes );
+}
 
-    int              idx;
-    char             line[256];
-    StringPtrArray * tokens;
-    TreePtr          tree;
+// The depth of the deepest node of the tree. Children are always stored after their parent, so one sweep
+// through the node array in order sees every parent before its children.
+int treeDepth( ParseTree * parse ) {
+    int * depth    = malloc( parse->nNodes * sizeof(int) );
+    int   maxDepth = 0;
+    int   node, child;
 
-    fgets( line, 256, stdin );
-    tokens = tokenize( line );
+    if( depth == NULL ) return -1;
+    depth[0] = 0;
+    for( node = 0; node < parse->nNodes; node++ ) {
+        TreePtr tree = &parse->nodes[node];
+        if( depth[node] > maxDepth ) maxDepth = depth[node];
+        for( child = 0; child < tree->nChildren; child++ ) depth[tree->firstChild + child] = depth[node] + 1;
+    }
+    free( depth );
+    return maxDepth;
+}
 
-    tree = malloc( sizeof(Tree) );
-    tree->rule      = tokens;
-    tree->nChildren = 0;
-    tree->children  = NULL;
+// Report the statistics for the program read from input (a path, or "-" for stdin) in the given format.
+void reportStats( StatsFormat format, char * input, bool compiled ) {
+    int pass;
 
-    // tokens.size is always > 0.
-    // If tokens.size == 1 we have an eps-rule (==> token 1 is a variable and there are no children)
-    // If tokens.size == 2 then either we have a terminal (==> no children) or we have a chain rule A --> B (==> one child).
-    // For all other cases there are children.
-    if( tokens->size > 1 && (! isTerminal(grammarSymbol)) ) {
-        tree->children  = malloc( (tokens->size - 1) * sizeof(Tree*) );  // -1 because there's no entry in children for the LHS, which is (*tokens->ptrArray)[0].
-        for( idx = 1; idx < tokens->size; idx++ ) {
-            char * next = (*(tokens->ptrArray))[idx];
-            (*tree->children)[tree->nChildren] = readParse( next );
-            tree->nChildren++;
+    if( format == STATS_JSON ) {
+        fputs( "{\"input\":\"", stderr );
+        for( ; *input != '\0'; input++ ) {
+            if( *input == '"' || *input == '\\' ) fputc( '\\', stderr );
+            if( (unsigned char) *input >= 0x20 ) fputc( *input, stderr );
+        }
+        fprintf( stderr, "\",\"compiled\":%s,\"passes\":[", compiled ? "true" : "false" );
+        for( pass = 0; pass < NUM_PASSES; pass++ ) {
+            fprintf( stderr, "%s{\"name\":\"%s\",\"seconds\":%.6f,\"allocations\":%ld,\"allocated_bytes\":%zu}",
+                     pass > 0 ? "," : "", passNames[pass], stats.seconds[pass], stats.allocations[pass], stats.allocatedBytes[pass] );
+        }
+        fprintf( stderr, "],\"nodes\":%d,\"max_depth\":%d,\"rule_matches\":%ld,\"output_bytes\":%zu,\"peephole_removed\":%ld}\n",
+                 stats.nNodes, stats.maxDepth, stats.ruleMatches, stats.outputBytes, stats.peepholeRemoved );
+    } else if( format == STATS_TEXT ) {
+        fprintf( stderr, "wlgen stats for %s%s:\n", input, compiled ? "" : " (failed)" );
+        for( pass = 0; pass < NUM_PASSES; pass++ ) {
+            fprintf( stderr, "    %-18s %10.6f s %8ld allocations %12zu bytes\n",
+                     passNames[pass], stats.seconds[pass], stats.allocations[pass], stats.allocatedBytes[pass] );
         }
+        fprintf( stderr, "    %d nodes, max depth %d, %ld rule matches, %zu bytes of output, %ld instructions removed by peephole\n",
+                 stats.nNodes, stats.maxDepth, stats.ruleMatches, stats.outputBytes, stats.peepholeRemoved );
     }
-    return tree;
 }
 
 // -----------------------------------------------------------------------------------------------------
 //
-// Pass two - building a symbol table.
+// Main.
 //
 // -----------------------------------------------------------------------------------------------------
 
-/* Build a list (actually an array) of symbols defined in tree by walking it. */
-StringPtrArray * symbolsDeclaredIn( TreePtr tree ) {
+// Set by command line options.
+bool        emitMachineCode = false;            // --mips: write machine code rather than assembly language.
+StatsFormat statsFormat     = STATS_NONE;       // --stats[=json]: report statistics for each program compiled.
+bool        optimize        = false;            // -O: generate faster code.
+bool        emitBinaryTree  = false;            // --emit-wlb: write the parse tree as a *.wlb file, not code.
+bool        emitTextTree    = false;            // --emit-wli: write the parse tree as a *.wli file, not code.
 
-    if( doesTreeNodeMatchRule(tree,"S BOF procedure EOF") ) {
-        /* Recurse on procedure */
-        return symbolsDeclaredIn( (*tree->children)[1] );
-    }
-    else if( doesTreeNodeMatchRule(tree,"procedure INT WAIN LPAREN dcl COMMA dcl RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE") ) {
-        StringPtrArray * ret = (StringPtrArray*) malloc( sizeof(StringPtrArray) );
-        ret->ptrArray        = NULL;
-        ret->size            = 0;
+// Compile the *.wli (or *.wlb, or *.wl) program on fd, writing its assembly language equivalent (or, with
+// --mips, the machine code for it; with --emit-wlb or --emit-wli, its parse tree in that format) to sink.
+// Returns true if the program compiled; otherwise errorMessage says why. Everything allocated along the way
+// is released either way and no state is carried over from one call to the next, so a single process can
+// compile any number of programs. Either way stats describes the compilation.
+bool compile( int fd, FILE * sink ) {
 
-        /* Recurse on dcl and dcl */
-        stringArrayAppend( ret, symbolsDeclaredIn( (*tree->children)[3] ) );
-        stringArrayAppend( ret, symbolsDeclaredIn( (*tree->children)[5] ) );
-        return ret;
-    }
-    else if( doesTreeNodeMatchRule(tree,"dcl INT ID") ) {
-        /* Recurse on ID */
-        return symbolsDeclaredIn( (*tree->children)[1] );
-    }
-    else if( ! strcmp( (*tree->rule->ptrArray)[0], "ID") ) {
-        StringPtrArray * ret = (StringPtrArray*) malloc( sizeof(StringPtrArray) );
-        ret->size            = 1;
-        ret->ptrArray        = malloc( sizeof(char*)              );
-        (*ret->ptrArray)[0]  = malloc( strlen((*tree->rule->ptrArray)[1]) + 1 );
-        strcpy( (*ret->ptrArray)[0], (*tree->rule->ptrArray)[1] );
-        return ret;
+    jmp_buf                recovery;
+    ParseTree   * volatile parseTree = NULL;    // Reconstructed from a *.wli or *.wlb file, or parsed from a *.wl file.
+    SymbolTable * volatile symbols   = NULL;    // The symbol table.
+    Emitter     * volatile program   = NULL;    // An assembly language equivalent to the WL program being compiled.
+    volatile bool          compiled  = false;
+
+    memset( &stats, 0, sizeof(stats) );
+
+    // Until errorRecovery is reset, reporting an error longjmp's back here with setjmp(...) returning 1.
+    errorRecovery = &recovery;
+    if( setjmp( recovery ) == 0 ) {
+        startPass( PASS_READ_PARSE );
+        parseTree = newParseTree();
+        readParse( parseTree, fd );                                                     // Read a *.wli (or *.wlb, or *.wl) input file, (re)building the program's parse tree.
+        endPass();
+        stats.nNodes = parseTree->nNodes;
+        if( statsFormat != STATS_NONE ) stats.maxDepth = treeDepth( parseTree );
+        if( DEBUG )  {
+            fputc( '\n', stderr );
+            printTree( parseTree, &parseTree->nodes[0] );
+            fputc( '\n', stderr );
+        }
+        if( emitBinaryTree || emitTextTree ) {
+            program = newEmitter( sink );
+            if( emitBinaryTree ) writeBinaryParse( parseTree, program );               // Just convert the tree.
+            else                 writeTextParse( parseTree, program );
+            flushEmitter( program );
+            stats.outputBytes = program->bytesEmitted;
+        } else {
+            startPass( PASS_SYMBOLS );
+            symbols = newSymbolTable();
+            symbolsDeclaredIn( parseTree, &parseTree->nodes[0], symbols );            // Walk the tree, building a table of the variables declared in it.
+            endPass();
+            if( optimize ) {
+                startPass( PASS_OPTIMIZE );
+                optimizeTree( parseTree, &parseTree->nodes[0], symbols );             // Fold constants and drop dead code.
+                endPass();
+            }
+            startPass( PASS_GENERATE );                                                 // Includes assembly, with --mips.
+            program = newEmitter( emitMachineCode || optimize ? NULL : sink );          // Machine code and -O need all of the assembly language at once.
+            generateCodeFor( parseTree, &parseTree->nodes[0], symbols, program );     // Walk the parse tree, streaming the generated code to sink.
+            if( optimize ) stats.peepholeRemoved = peephole( program );
+            if( emitMachineCode ) {
+                assemble( program, sink );
+            } else {
+                program->sink = sink;
+                flushEmitter( program );
+            }
+            if( ! emitMachineCode ) stats.outputBytes = program->bytesEmitted;
+            endPass();
+        }
+        compiled = true;
     }
-    else bail( tree->rule );
-    return NULL;                // Should never get here.
+    errorRecovery = NULL;
+    if( currentPass != NO_PASS ) endPass();                                             // The pass that failed.
+
+    if( program   != NULL ) freeEmitter( program );
+    if( symbols   != NULL ) freeSymbolTable( symbols );
+    if( parseTree != NULL ) freeParseTree( parseTree );
+    return compiled;
 }
 
-// -----------------------------------------------------------------------------------------------------
+// Assemble the generated code held in program and write the resulting machine code to sink, just as
+// java cs241.binasm would.
+void assemble( Emitter * program, FILE * sink ) {
+    MipsAssembly machineCode;
+    bool         assembled = mipsAssemble( program->buffer, program->length, &machineCode );
+    bool         written   = assembled && mipsWriteProgram( sink, machineCode.words, machineCode.nWords );
+
+    stats.outputBytes = 4 * machineCode.nWords;
+    freeMipsAssembly( &machineCode );
+    if( ! assembled ) reportError( "the generated code failed to assemble (%s)", machineCode.error );
+    if( ! written   ) panicExit( "failed to write the output" );
+}
+
+// Batch mode: compile each of the *.wli files in paths[0] ... paths[nPaths-1] and, if manifest isn't NULL,
+// each of the files listed (one per line) in the file manifest ("-" meaning stdin). The program in foo.wli (or
+// foo.wlb, or foo.wl) is compiled to foo.asm (or foo.mips, with --mips; foo.wlb or foo.wli, with --emit-wlb or
+// --emit-wli), and one line recording the outcome is written to stdout for each input:
 //
-// Pass three - code generation.
+//     foo.wli<TAB>ok
+//     bar.wli<TAB>error<TAB>ERROR: use of undeclared variable c
 //
-// -----------------------------------------------------------------------------------------------------
+// A failure only affects the input that caused it; the batch carries on with the next one. Returns the
+// exit status for the whole batch: 0 if every input compiled, 1 otherwise.
+bool compileBatchItem( char * path ) {
 
-/* Generate the code for the parse tree. */
-char * generateCodeFor( TreePtr tree, StringPtrArray * symbolTable  ) {
+    char   * extension = emitBinaryTree ? ".wlb" : emitTextTree ? ".wli" : emitMachineCode ? ".mips" : ".asm";
+    size_t   length    = strlen( path );
+    char   * asmPath   = malloc( length + strlen( extension ) + 1 );
+    bool     compiled  = false;
+    int      fd;
+    FILE   * sink;
 
-    if( doesTreeNodeMatchRule(tree,"S BOF procedure EOF") ) {
-        char * rec = generateCodeFor( (*tree->children)[1], symbolTable );
-        char * ret = malloc( strlen(rec) + 8 );
-        strcpy( ret, rec        );
-        strcat( ret, "jr $31\n" );
-        free( rec );
-        return ret;
+    if( asmPath == NULL ) panicExit( "out of memory" );
+    strcpy( asmPath, path );
+    if( length > 4 && (! strcmp( asmPath + length - 4, ".wli" ) || ! strcmp( asmPath + length - 4, ".wlb" )) ) {
+        asmPath[length - 4] = '\0';
+    } else if( length > 3 && ! strcmp( asmPath + length - 3, ".wl" ) ) {
+        asmPath[length - 3] = '\0';
     }
-    else if( doesTreeNodeMatchRule(tree,"procedure INT WAIN LPAREN dcl COMMA dcl RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE") ) {
-        return generateCodeFor( (*tree->children)[11], symbolTable );
+    strcat( asmPath, extension );
+
+    fd = open( path, O_RDONLY );
+    if( ! strcmp( asmPath, path ) ) {
+        snprintf( errorMessage, sizeof(errorMessage), "ERROR: %s would overwrite itself", path );
+        if( fd >= 0 ) close( fd );
+    } else if( fd < 0 ) {
+        snprintf( errorMessage, sizeof(errorMessage), "ERROR: can't open %s", path );
+    } else if( (sink = fopen( asmPath, "w" )) == NULL ) {
+        snprintf( errorMessage, sizeof(errorMessage), "ERROR: can't create %s", asmPath );
+        close( fd );
+    } else {
+        compiled = compile( fd, sink );
+        reportStats( statsFormat, path, compiled );
+        if( fclose( sink ) != 0 && compiled ) {
+            snprintf( errorMessage, sizeof(errorMessage), "ERROR: failed to write %s", asmPath );
+            compiled = false;
+        }
+        if( ! compiled ) unlink( asmPath );
+        close( fd );
     }
-    else if( doesTreeNodeMatchRule(tree,"expr term") ) {
-        return generateCodeFor( (*tree->children)[0], symbolTable );
+
+    if( compiled ) {
+        printf( "%s\tok\n", path );
+    } else {
+        printf( "%s\terror\t%s\n", path, errorMessage );
     }
-    else if( doesTreeNodeMatchRule(tree,"term factor") ) {
-        return generateCodeFor( (*tree->children)[0], symbolTable );
+    fflush( stdout );
+    free( asmPath );
+    return compiled;
+}
+
+int compileBatch( char * paths[], int nPaths, char * manifest ) {
+
+    bool     allCompiled = true;
+    int      idx;
+
+    for( idx = 0; idx < nPaths; idx++ ) {
+        if( ! compileBatchItem( paths[idx] ) ) allCompiled = false;
     }
-    else if( doesTreeNodeMatchRule(tree,"factor ID") ) {
-        return generateCodeFor( (*tree->children)[0], symbolTable );
+
+    if( manifest != NULL ) {
+        FILE   * list   = strcmp( manifest, "-" ) ? fopen( manifest, "r" ) : stdin;
+        char   * line   = NULL;
+        size_t   size   = 0;
+        ssize_t  length;
+
+        if( list == NULL ) panicExit( "can't open the manifest" );
+        while( (length = getline( &line, &size, list )) >= 0 ) {
+            while( length > 0 && (line[length-1] == '\n' || line[length-1] == '\r') ) line[--length] = '\0';
+            if( length == 0 || line[0] == '#' ) continue;                          // Skip blank lines and comments.
+            if( ! compileBatchItem( line ) ) allCompiled = false;
+        }
+        free( line );
+        if( list != stdin ) fclose( list );
     }
-    else if( ! strcmp((*tree->rule->ptrArray)[0], "ID") ) {
-        char *name = (*tree->rule->ptrArray)[1];
-        char *ret  = (char*) malloc(14);
-        if( ! strcmp( name, (*symbolTable->ptrArray)[0]) ) strcpy( ret, "add $3,$0,$1\n" );
-        if( ! strcmp( name, (*symbolTable->ptrArray)[1]) ) strcpy( ret, "add $3,$0,$2\n" );
-        return ret;
+    return allCompiled ? 0 : 1;
+}
+
+// The benchmark harness (wlbench.c) #include's this file with WLGEN_NO_MAIN defined, to drive the passes
+// itself.
+#ifndef WLGEN_NO_MAIN
+
+void usage( char * program ) {
+    fprintf( stderr, "usage: %s [-O] [--mips | --emit-wlb | --emit-wli] [--stats[=json]] [file.wl|file.wli|file.wlb]\n", program );
+    fprintf( stderr, "       %s --batch [-O] [--mips | --emit-wlb | --emit-wli] [--stats[=json]] [--manifest list|-] [file ...]\n", program );
+    exit(1);
+}
+
+int main( int argc, char * argv[] ) {
+
+    bool     batch    = false;
+    char   * manifest = NULL;
+    int      argi;
+
+    #if defined(IDE) && defined(DMALLOC)
+        // 1st param - one of: DMALLOC_runtimeFor241, DMALLOC_lowFor241, DMALLOC_mediumFor241, DMALLOC_highFor241.
+        // 2nd param - most useful possibilities are: print-messages, log=logfile, inter=100, and log-trans
+        //             (logs all calls to dmalloc cover routines). Separate these tokens by commas when you
+        //             want to supply more than one - eg "print-messages,inter=10".
+        dmalloc_setup( DMALLOC_highFor241, "print-messages" );
+    #endif
+
+    initGrammar();
+
+    // argv[0] is always the name of the program being run. It may be followed by options:
+    //     --batch            compile each of the inputs named by the remaining arguments to its own *.asm file
+    //     --manifest FILE    (with --batch) also compile each input listed in FILE
+    //     --mips             write machine code, as java cs241.binasm would, instead of assembly language
+    //     --emit-wlb         convert the input to a *.wlb file (see readBinaryParse(...)) instead of compiling it
+    //     --emit-wli         convert the input to a *.wli file, as java cs241.WLParse would, instead of compiling it
+    //     --stats[=json]     after compiling, report time and allocations per pass and more on stderr
+    //     -O                 optimize the generated code
+    for( argi = 1; argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0'; argi++ ) {
+        if( ! strcmp( argv[argi], "--batch" ) ) {
+            batch = true;
+        } else if( ! strcmp( argv[argi], "--mips" ) ) {
+            emitMachineCode = true;
+        } else if( ! strcmp( argv[argi], "--emit-wlb" ) ) {
+            emitBinaryTree = true;
+        } else if( ! strcmp( argv[argi], "--emit-wli" ) ) {
+            emitTextTree = true;
+        } else if( ! strcmp( argv[argi], "--stats" ) || ! strcmp( argv[argi], "--stats=text" ) ) {
+            statsFormat = STATS_TEXT;
+        } else if( ! strcmp( argv[argi], "--stats=json" ) ) {
+            statsFormat = STATS_JSON;
+        } else if( ! strcmp( argv[argi], "-O" ) ) {
+            optimize = true;
+        } else if( ! strcmp( argv[argi], "--manifest" ) && argi + 1 < argc ) {
+            manifest = argv[++argi];
+        } else {
+            usage( argv[0] );
+        }
     }
-    else bail( tree->rule );
-    return 0;
+    if( DEBUG ) fprintf( stderr, "argv[0] = %s, %d input(s)\n", argv[0], argc - argi );
+
+    if( emitMachineCode + emitBinaryTree + emitTextTree > 1 ) usage( argv[0] );
+    if( batch ) return compileBatch( &argv[argi], argc - argi, manifest );
+    if( manifest != NULL || argc - argi > 1 ) usage( argv[0] );
+
+    // Otherwise argv[argi], when present, is assumed to be a path to an input wl, wli or wlb file; if it's
+    // absent the input is read from stdin. The generated code is written to stdout.
+    int fd = STDIN_FILENO;
+    if( argi < argc ) {
+        fd = open( argv[argi], O_RDONLY );
+        if( fd < 0 ) panicExit( "can't open the specified input file" );
+    };
+
+    bool compiled = compile( fd, stdout );
+    if( ! compiled ) fprintf( stderr, "%s\n", errorMessage );
+    reportStats( statsFormat, argi < argc ? argv[argi] : "-", compiled );
+
+    #if defined(DMALLOC) && false
+        // Actually dmalloc_shutdown(...) is called automatically at exit. But sometimes when debugging it's
+        // useful to dump the list of unfreed memory *before* exiting so we can poke around with a debugger.
+        dmalloc_shutdown();
+    #endif
+
+    close( fd );
+    return compiled ? 0 : 1;
 }
 
+#endif // WLGEN_NO_MAIN
+
 // -----------------------------------------------------------------------------------------------------
 //
-// Misc helpers.
+// Pass one - building the parse tree.
 //
 // -----------------------------------------------------------------------------------------------------
 
-// Print an error message regarding an un-recogized rule and exit the program, reporting a non-zero status code.
-void bail( StringPtrArray * rule ) {
-    int i;
-    fprintf(stderr, "ERROR: unrecognized rule");
-//    for (i=0; i < msg.size; i++) fprintf(stderr, " %s", msg.ptrArray[i]);
-    for( i = 0; i < rule->size; i++ ) {
-        fprintf( stderr, " %s", (*rule->ptrArray)[i]);
+// Read the whole of the *.wli input on fd into parse->text. A regular file (a path given on the command
+// line, or stdin redirected from a file) is simply mapped into memory; anything else (eg a pipe) is read in
+// large chunks into a buffer that doubles in size as needed. Either way nothing is copied line by line:
+// tokens and lexemes are slices of this one block of text.
+#define INPUT_CHUNK_SIZE (1024 * 1024)
+
+void loadInput( ParseTree * parse, int fd ) {
+    struct stat info;
+
+    if( fstat( fd, &info ) == 0 && S_ISREG( info.st_mode ) && info.st_size > 0 ) {
+        void * text = mmap( NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( text != MAP_FAILED ) {
+            parse->text       = text;
+            parse->textLength = info.st_size;
+            parse->textMapped = true;
+            return;
+        }
+    }
+
+    // parse->text is kept up to date as the buffer grows so that freeParseTree(...) can release it even if
+    // reading fails part way through.
+    size_t  capacity = INPUT_CHUNK_SIZE;
+    ssize_t bytesRead;
+    parse->text       = countedMalloc( capacity );
+    parse->textLength = 0;
+    parse->textMapped = false;
+    if( parse->text == NULL ) panicExit( "out of memory" );
+    while( (bytesRead = read( fd, parse->text + parse->textLength, capacity - parse->textLength )) != 0 ) {
+        if( bytesRead < 0 ) panicExit( "failed to read the input" );
+        parse->textLength += bytesRead;
+        if( parse->textLength == capacity ) {
+            char * text = countedRealloc( parse->text, 2 * capacity );
+            if( text == NULL ) panicExit( "out of memory" );
+            parse->text = text;
+            capacity   *= 2;
+        }
     }
-    fprintf(stderr, "\n");
-    exit(1);
 }
 
-// Report a more general disaster and exit the program, reporting a non-zero status code.
-void panicExit( char * rule ) {
-    fprintf( stderr, "ERROR: %s\n.", rule );
-    exit(1);
+#define MAX_LINE_TOKENS (MAX_RHS_LENGTH + 1)
+
+// Split the next line of the input, starting at *pos, into at most MAX_LINE_TOKENS tokens, recording the
+// offset and length of each. Advances *pos past the line and returns the number of tokens found, or
+// MAX_LINE_TOKENS + 1 if there were too many (no rule of WL has that many symbols). *lineStart and
+// *lineLength are set to the extent of the line, for error messages.
+int tokenizeLine( ParseTree * parse, size_t * pos, int starts[], int lengths[], int * lineStart, int * lineLength ) {
+    char   * text    = parse->text;
+    size_t   end     = parse->textLength;
+    size_t   cursor  = *pos;
+    int      nTokens = 0;
+
+    *lineStart = cursor;
+    while( cursor < end && text[cursor] != '\n' ) {
+        if( text[cursor] == ' ' || text[cursor] == '\t' || text[cursor] == '\r' ) {
+            cursor++;
+        } else {
+            size_t start = cursor;
+            while( cursor < end && text[cursor] != '\n' && text[cursor] != ' '
+                   && text[cursor] != '\t' && text[cursor] != '\r' ) cursor++;
+            if( nTokens < MAX_LINE_TOKENS ) {
+                starts[nTokens]  = start;
+                lengths[nTokens] = cursor - start;
+            }
+            nTokens++;
+        }
+    }
+    *lineLength = cursor - *lineStart;
+    *pos        = cursor < end ? cursor + 1 : cursor;    // Skip the '\n'.
+    return nTokens <= MAX_LINE_TOKENS ? nTokens : MAX_LINE_TOKENS + 1;
 }
 
-// -----------------------------------------------------------------------------------------------------
-//
-// Useful when debugging.
+// Read a *.wli file from fd, reconstructing the program's parse tree in parse (a newParseTree()). A *.wlb file
+// is recognized and read by readBinaryParse(...) instead, and WL source is parsed by parseSource(...).
 //
-// -----------------------------------------------------------------------------------------------------
+// The lines of a *.wli file list the nodes of the tree in preorder. Rather than recursing once per grammar
+// symbol (which would limit how deeply statements and expressions could nest) we keep the nodes whose lines
+// have yet to be read on the work stack. Reading a node's line reserves consecutive slots for its children,
+// records in each slot the symbol the child must be an instance of, and pushes the slots in reverse order so
+// that the first child is read next.
+void readParse( ParseTree * parse, int fd ) {
 
-void printStringPtrArray( StringPtrArray * spa ) {
-    if( spa == NULL ) {
-        fprintf( stderr, "ptr is <null>\n" );
-    } else {
-        fprintf( stderr, "%d: ", spa->size );
-        int idx;
-        for( idx = 0; idx < spa->size; idx ++ ) {
-            fprintf( stderr, "%s ", (*spa->ptrArray)[idx] );
+    size_t      pos   = 0;
+    size_t      idx;
+    int         nLines    = 1;
+
+    loadInput( parse, fd );
+    if( parse->textLength > INT_MAX ) panicExit( "the input is too large" );    // Offsets into it are ints.
+    if( readBinaryParse( parse ) || parseSource( parse ) ) return;
+
+    // Every line of the input is a node, so count them to size the node array once.
+    for( idx = 0; idx < parse->textLength; idx++ ) if( parse->text[idx] == '\n' ) nLines++;
+    parse->nodes    = arenaAlloc( &parse->arena, nLines * sizeof(Tree) );
+    parse->maxNodes = nLines;
+
+    allocNodes( parse, 1 );
+    parse->nodes[0].symbol = SYM_S;
+    pushWork( parse, &parse->nodes[0] );
+
+    while( parse->nWork > 0 ) {
+        int      starts[MAX_LINE_TOKENS];
+        int      lengths[MAX_LINE_TOKENS];
+        int      lineStart;
+        int      lineLength;
+        int      nTokens;
+        int      child;
+        TreePtr  tree = popWork( parse );
+        int      node = tree - parse->nodes;
+
+        if( pos >= parse->textLength ) panicExit( "unexpected end of input" );
+        nTokens = tokenizeLine( parse, &pos, starts, lengths, &lineStart, &lineLength );
+        if( nTokens == 0 ) panicExit( "blank line in input" );
+
+        tree->nChildren    = 0;
+        tree->firstChild   = 0;
+        tree->lexeme       = NO_LEXEME;
+        tree->lexemeLength = 0;
+
+        // If nTokens == 1 we have an eps-rule (==> token 1 is a variable and there are no children)
+        // If nTokens == 2 then either we have a terminal (==> no children) or we have a chain rule A --> B (==> one child).
+        // For all other cases there are children.
+        if( isTerminal(tree->symbol) ) {
+            tree->ruleId = RULE_TERMINAL;
+            if( nTokens != 2 || symbolIdFor( parse->text + starts[0], lengths[0] ) != tree->symbol ) {
+                tree->ruleId = RULE_UNKNOWN;
+            } else {
+                tree->lexeme       = starts[1];
+                tree->lexemeLength = lengths[1];
+            }
+        } else if( nTokens > MAX_LINE_TOKENS ) {
+            tree->ruleId = RULE_UNKNOWN;
+        } else {
+            SymbolId rhs[MAX_RHS_LENGTH];
+            for( child = 0; child < nTokens - 1; child++ ) {
+                rhs[child] = symbolIdFor( parse->text + starts[child+1], lengths[child+1] );
+            }
+            tree->ruleId = ruleIdFor( symbolIdFor( parse->text + starts[0], lengths[0] ), rhs, nTokens - 1 );
+            stats.ruleMatches++;
+            if( tree->ruleId != RULE_UNKNOWN && grammar[tree->ruleId].lhs != tree->symbol ) {
+                tree->ruleId = RULE_UNKNOWN;
+            }
         }
-        fprintf( stderr, "\n" );
-    }
+
+        if( tree->ruleId == RULE_UNKNOWN ) {
+            tree->lexeme       = lineStart;
+            tree->lexemeLength = lineLength;
+            bail( parse, tree );
+        }
+
+        if( tree->ruleId != RULE_TERMINAL ) {
+            Rule * rule  = &grammar[tree->ruleId];
+            int    first = allocNodes( parse, rule->rhsLength );
+
+            tree = &parse->nodes[node];           // Reserving the children may have moved the node array.
+            tree->firstChild = first;
+            tree->nChildren  = rule->rhsLength;
+
+            for( child = rule->rhsLength - 1; child >= 0; child-- ) {
+                parse->nodes[first + child].symbol = rule->rhs[child];
+                pushWork( parse, &parse->nodes[first + child] );
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Pass one - the binary parse tree format (*.wlb).
+//
+// -----------------------------------------------------------------------------------------------------
+
+// A *.wlb file holds the same tree as a *.wli file, but in a form that can be loaded without tokenizing a
+// line or comparing a string per node. wlgen --emit-wlb converts a *.wli file to one, and readParse(...)
+// hands every input to readBinaryParse(...) first, which recognizes one by its magic number. All numbers
+// are unsigned and little-endian; "word" means four bytes. In order, the file holds:
+//
+//     the header       the magic number "\177WLB", then the version, nSymbols, nRules, nLexemes,
+//                      lexemeBytes and nNodes, one word each, and a word of padding
+//     the symbols      nSymbols names, each one byte of length followed by the name - symbol i of the
+//                      file is the i'th of these
+//     the rules        nRules rules, each the symbol on the LHS, the # of symbols on the RHS and those
+//                      symbols, one byte each - rule i of the file is the i'th of these
+//     the lexemes      nLexemes (offset, length) pairs of words, locating each distinct lexeme in ...
+//     the text         ... lexemeBytes bytes of lexemes, one after the other
+//     the nodes        nNodes nodes in preorder (the order of the lines of a *.wli file), 8 bytes each:
+//                      the rule (WLB_TERMINAL for a leaf), the symbol, the # of children (two bytes), and
+//                      for a leaf the lexeme (a word) - WLB_NO_LEXEME otherwise
+//
+// Naming the symbols and spelling out the rules in the file means that its ids don't have to agree with
+// SymbolId and RuleId: readBinaryParse(...) maps them once, up front. Lexemes are stored once however often
+// they appear, and their text is left where it is, in the mapped file, just as lexemes of a *.wli file are.
+
+#define WLB_MAGIC          "\177WLB"
+#define WLB_VERSION        1
+#define WLB_HEADER_SIZE    32
+#define WLB_NODE_SIZE      8
+#define WLB_TERMINAL       0xff
+#define WLB_NO_LEXEME      0xffffffffu
+#define WLB_MAX_IDS        255               // Symbol and rule ids are single bytes; 0xff is WLB_TERMINAL.
+
+unsigned decodeWord( unsigned char * bytes ) {
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (unsigned) bytes[3] << 24;
+}
+
+void encodeWord( unsigned char * bytes, unsigned value ) {
+    bytes[0] = value;
+    bytes[1] = value >> 8;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 24;
+}
+
+void emitWord( Emitter * out, unsigned value ) {
+    unsigned char bytes[4];
+    encodeWord( bytes, value );
+    emitBytes( out, (char*) bytes, 4 );
+}
+
+// Report that node (counting from 0, in preorder) of a *.wlb file, or the file as a whole if node < 0, is bad.
+void binaryParseError( long node, char * message ) {
+    if( node < 0 ) reportError( "%s in the binary parse tree", message );
+    reportError( "%s at node %ld of the binary parse tree", message, node );
+}
+
+// If the input already loaded into parse->text (see readParse(...)) is a *.wlb file, rebuild the parse tree
+// from it and return true; otherwise return false, leaving it to readParse(...). The nodes are placed exactly
+// as readParse(...) places them, using the work stack in the same way.
+bool readBinaryParse( ParseTree * parse ) {
+
+    unsigned char * bytes  = (unsigned char*) parse->text;
+    size_t          length = parse->textLength;
+    size_t          pos    = WLB_HEADER_SIZE;
+    unsigned        nSymbols, nRules, nLexemes, lexemeBytes, nNodes;
+    SymbolId        symbolMap[WLB_MAX_IDS];
+    RuleId          ruleMap[WLB_MAX_IDS];
+    size_t          lexemes, text, nodes;
+    unsigned        idx, next = 0;
+
+    // Every input comes through here first, so nothing past its end may be read until it's known to be a
+    // *.wlb file with a whole header.
+    if( length < WLB_HEADER_SIZE || memcmp( bytes, WLB_MAGIC, 4 ) ) return false;
+    if( decodeWord( bytes + 4 ) != WLB_VERSION ) binaryParseError( -1, "unsupported version" );
+    nSymbols    = decodeWord( bytes + 8  );
+    nRules      = decodeWord( bytes + 12 );
+    nLexemes    = decodeWord( bytes + 16 );
+    lexemeBytes = decodeWord( bytes + 20 );
+    nNodes      = decodeWord( bytes + 24 );
+    if( nSymbols > WLB_MAX_IDS || nRules > WLB_MAX_IDS ) binaryParseError( -1, "too many symbols or rules" );
+
+    for( idx = 0; idx < nSymbols; idx++ ) {
+        if( pos >= length || pos + 1 + bytes[pos] > length ) binaryParseError( -1, "truncated symbols" );
+        symbolMap[idx] = symbolIdFor( parse->text + pos + 1, bytes[pos] );
+        pos += 1 + bytes[pos];
+    }
+    for( idx = 0; idx < nRules; idx++ ) {
+        SymbolId lhs, rhs[MAX_RHS_LENGTH];
+        int      rhsLength, child;
+        bool     known;
+
+        if( pos + 2 > length || pos + 2 + bytes[pos+1] > length ) binaryParseError( -1, "truncated rules" );
+        rhsLength = bytes[pos+1];
+        known     = bytes[pos] < nSymbols && rhsLength <= MAX_RHS_LENGTH;
+        lhs       = known ? symbolMap[bytes[pos]] : SYM_UNKNOWN;
+        for( child = 0; known && child < rhsLength; child++ ) {
+            known      = bytes[pos+2+child] < nSymbols;
+            rhs[child] = known ? symbolMap[bytes[pos+2+child]] : SYM_UNKNOWN;
+        }
+        ruleMap[idx] = known ? ruleIdFor( lhs, rhs, rhsLength ) : RULE_UNKNOWN;
+        pos += 2 + rhsLength;
+    }
+
+    // Check the sizes of the remaining sections against the size of the file before trusting any of them.
+    lexemes = pos;
+    text    = lexemes + 8 * (size_t) nLexemes;
+    nodes   = text + lexemeBytes;
+    if( text > length || nodes > length || (length - nodes) / WLB_NODE_SIZE < nNodes ) {
+        binaryParseError( -1, "truncated lexemes or nodes" );
+    }
+    if( nodes + (size_t) nNodes * WLB_NODE_SIZE != length ) binaryParseError( -1, "trailing data" );
+    for( idx = 0; idx < nLexemes; idx++ ) {
+        unsigned offset = decodeWord( bytes + lexemes + 8 * idx );
+        if( offset > lexemeBytes || decodeWord( bytes + lexemes + 8 * idx + 4 ) > lexemeBytes - offset ) {
+            binaryParseError( -1, "a lexeme outside the text" );
+        }
+    }
+
+    parse->nodes    = arenaAlloc( &parse->arena, (nNodes > 0 ? nNodes : 1) * sizeof(Tree) );
+    parse->maxNodes = nNodes > 0 ? nNodes : 1;
+
+    allocNodes( parse, 1 );
+    parse->nodes[0].symbol = SYM_S;
+    pushWork( parse, &parse->nodes[0] );
+
+    while( parse->nWork > 0 ) {
+        TreePtr         tree   = popWork( parse );
+        int             node   = tree - parse->nodes;
+        unsigned char * record = bytes + nodes + (size_t) next * WLB_NODE_SIZE;
+        unsigned        nChildren, lexeme;
+        int             child;
+
+        if( next == nNodes ) binaryParseError( next, "unexpected end of nodes" );
+        nChildren = record[2] | record[3] << 8;
+        lexeme    = decodeWord( record + 4 );
+
+        tree->nChildren    = 0;
+        tree->firstChild   = 0;
+        tree->lexeme       = NO_LEXEME;
+        tree->lexemeLength = 0;
+
+        if( record[0] == WLB_TERMINAL ) {
+            if( record[1] >= nSymbols || symbolMap[record[1]] != tree->symbol || ! isTerminal(tree->symbol)
+                || nChildren != 0 || lexeme >= nLexemes ) {
+                binaryParseError( next, "unrecognized leaf" );
+            }
+            tree->ruleId       = RULE_TERMINAL;
+            tree->lexeme       = text + decodeWord( bytes + lexemes + 8 * lexeme );
+            tree->lexemeLength = decodeWord( bytes + lexemes + 8 * lexeme + 4 );
+        } else {
+            Rule * rule;
+            int    first;
+
+            if( record[0] >= nRules || ruleMap[record[0]] == RULE_UNKNOWN ) binaryParseError( next, "unrecognized rule" );
+            tree->ruleId = ruleMap[record[0]];
+            rule         = &grammar[tree->ruleId];
+            if( rule->lhs != tree->symbol || nChildren != (unsigned) rule->rhsLength || lexeme != WLB_NO_LEXEME ) {
+                binaryParseError( next, "unexpected rule" );
+            }
+
+            first = allocNodes( parse, rule->rhsLength );
+            tree  = &parse->nodes[node];           // Reserving the children may have moved the node array.
+            tree->firstChild = first;
+            tree->nChildren  = rule->rhsLength;
+            for( child = rule->rhsLength - 1; child >= 0; child-- ) {
+                parse->nodes[first + child].symbol = rule->rhs[child];
+                pushWork( parse, &parse->nodes[first + child] );
+            }
+        }
+        next++;
+    }
+    if( next != nNodes ) binaryParseError( next, "trailing nodes" );
+    return true;
+}
+
+// Write the parse tree to out in the *.wlb format described above. Identical lexemes (eg every use of a
+// variable) are found with a hash table and stored once.
+void writeBinaryParse( ParseTree * parse, Emitter * out ) {
+
+    int      * lexemeOfNode = countedMalloc( parse->nNodes * sizeof(int) );     // Its # in the lexeme table.
+    int      * firstUse     = countedMalloc( parse->nNodes * sizeof(int) );     // A node with lexeme #i, for each i.
+    int        nSlots       = 64;
+    int      * slots;
+    int        nLexemes     = 0;
+    unsigned   lexemeBytes  = 0;
+    int        idx, child;
+
+    if( lexemeOfNode == NULL || firstUse == NULL ) panicExit( "out of memory" );
+    while( nSlots < 2 * parse->nNodes ) nSlots *= 2;
+    slots = countedMalloc( nSlots * sizeof(int) );
+    if( slots == NULL ) panicExit( "out of memory" );
+    for( idx = 0; idx < nSlots; idx++ ) slots[idx] = -1;
+
+    for( idx = 0; idx < parse->nNodes; idx++ ) {
+        TreePtr  tree = &parse->nodes[idx];
+        unsigned slot;
+
+        lexemeOfNode[idx] = -1;
+        if( tree->ruleId != RULE_TERMINAL ) continue;
+        slot = hashString( lexemeOf(parse,tree), tree->lexemeLength ) & (nSlots - 1);
+        while( slots[slot] >= 0 ) {
+            TreePtr seen = &parse->nodes[firstUse[slots[slot]]];
+            if( seen->lexemeLength == tree->lexemeLength
+                && ! memcmp( lexemeOf(parse,seen), lexemeOf(parse,tree), tree->lexemeLength ) ) break;
+            slot = (slot + 1) & (nSlots - 1);
+        }
+        if( slots[slot] < 0 ) {
+            slots[slot]          = nLexemes;
+            firstUse[nLexemes++] = idx;
+        }
+        lexemeOfNode[idx] = slots[slot];
+    }
+
+    emitBytes( out, WLB_MAGIC, 4 );
+    emitWord( out, WLB_VERSION );
+    emitWord( out, NUM_SYMBOLS );
+    emitWord( out, NUM_RULES );
+    emitWord( out, nLexemes );
+    for( idx = 0; idx < nLexemes; idx++ ) lexemeBytes += parse->nodes[firstUse[idx]].lexemeLength;
+    emitWord( out, lexemeBytes );
+    emitWord( out, parse->nNodes );
+    emitWord( out, 0 );                                          // Pads the header to WLB_HEADER_SIZE.
+
+    for( idx = 0; idx < NUM_SYMBOLS; idx++ ) {
+        char length = strlen( symbolNames[idx] );
+        emitBytes( out, &length, 1 );
+        emitString( out, symbolNames[idx] );
+    }
+    for( idx = 0; idx < NUM_RULES; idx++ ) {
+        char rule[2 + MAX_RHS_LENGTH];
+        rule[0] = grammar[idx].lhs;
+        rule[1] = grammar[idx].rhsLength;
+        for( child = 0; child < grammar[idx].rhsLength; child++ ) rule[2+child] = grammar[idx].rhs[child];
+        emitBytes( out, rule, 2 + grammar[idx].rhsLength );
+    }
+
+    lexemeBytes = 0;
+    for( idx = 0; idx < nLexemes; idx++ ) {
+        emitWord( out, lexemeBytes );
+        emitWord( out, parse->nodes[firstUse[idx]].lexemeLength );
+        lexemeBytes += parse->nodes[firstUse[idx]].lexemeLength;
+    }
+    for( idx = 0; idx < nLexemes; idx++ ) {
+        TreePtr tree = &parse->nodes[firstUse[idx]];
+        emitBytes( out, lexemeOf(parse,tree), tree->lexemeLength );
+    }
+
+    // The nodes, in preorder: the children of a node are pushed in reverse so that the first is popped next.
+    pushWork( parse, &parse->nodes[0] );
+    while( parse->nWork > 0 ) {
+        TreePtr       tree = popWork( parse );
+        int           node = tree - parse->nodes;
+        unsigned char record[WLB_NODE_SIZE];
+
+        record[0] = tree->ruleId == RULE_TERMINAL ? WLB_TERMINAL : tree->ruleId;
+        record[1] = tree->symbol;
+        record[2] = tree->nChildren;
+        record[3] = tree->nChildren >> 8;
+        encodeWord( record + 4, lexemeOfNode[node] >= 0 ? (unsigned) lexemeOfNode[node] : WLB_NO_LEXEME );
+        emitBytes( out, (char*) record, WLB_NODE_SIZE );
+        for( child = tree->nChildren - 1; child >= 0; child-- ) pushWork( parse, childOf(parse,tree,child) );
+    }
+
+    free( slots );
+    free( firstUse );
+    free( lexemeOfNode );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Pass one - scanning and parsing WL source (*.wl).
+//
+// -----------------------------------------------------------------------------------------------------
+
+// wlgen can compile a *.wl program itself, without java cs241.WLScan and cs241.WLParse: readParse(...) hands
+// any input that isn't a *.wlb file and doesn't start like a *.wli file (with the line for S) to
+// parseSource(...). That builds exactly the tree that reading WLParse's output would - the same nodes in the
+// same slots - so nothing after pass one can tell the difference, and wlgen --emit-wli writes out the text
+// WLParse would have produced.
+//
+// The scanner follows WLScan: the longest token that matches wins, IDs that spell a keyword are keywords,
+// whitespace and // comments separate tokens, a NUM is either 0 or doesn't start with 0, and a carriage
+// return is an error. The parser is an SLR(1) parser, like WLParse, whose tables buildParseTables(...)
+// constructs from grammar[] the first time they're needed. Its stack is an array rather than the C stack, so
+// nesting is limited only by memory. An LR parser builds each node after its children, so the nodes are
+// built in that order first and then laid out in the order readParse(...) uses.
+
+typedef struct Token_ {
+    SymbolId  symbol;                 // SYM_EOF once the input is used up.
+    int       start;                  // Offset of the lexeme in the input text.
+    int       length;
+} Token;
+
+char     * keywords[]       = { "int",   "wain",   "if",   "else",   "while",   "println",   "return"   };
+SymbolId   keywordSymbols[] = { SYM_INT, SYM_WAIN, SYM_IF, SYM_ELSE, SYM_WHILE, SYM_PRINTLN, SYM_RETURN };
+
+#define NUM_KEYWORDS ((int) (sizeof(keywords) / sizeof(keywords[0])))
+
+// The # of the line of the input that offset pos is on, for error messages.
+int lineOf( ParseTree * parse, size_t pos ) {
+    int    line = 1;
+    size_t idx;
+    for( idx = 0; idx < pos && idx < parse->textLength; idx++ ) if( parse->text[idx] == '\n' ) line++;
+    return line;
+}
+
+// Scan the token of the WL source in parse->text that starts at or after *pos into token, and advance *pos
+// past it.
+void scanToken( ParseTree * parse, size_t * pos, Token * token ) {
+
+    char   * text   = parse->text;
+    size_t   end    = parse->textLength;
+    size_t   cursor = *pos;
+    int      idx;
+
+    for( ;; ) {                                            // Skip whitespace and comments.
+        while( cursor < end && isspace( (unsigned char) text[cursor] ) && text[cursor] != '\r' ) cursor++;
+        if( cursor + 1 >= end || text[cursor] != '/' || text[cursor+1] != '/' ) break;
+        while( cursor < end && text[cursor] != '\n' ) cursor++;
+    }
+
+    token->start = cursor;
+    if( cursor == end ) {
+        token->symbol = SYM_EOF;
+    } else if( isalpha( (unsigned char) text[cursor] ) ) {
+        while( cursor < end && isalnum( (unsigned char) text[cursor] ) ) cursor++;
+        token->symbol = SYM_ID;
+        for( idx = 0; idx < NUM_KEYWORDS; idx++ ) {
+            if( ! strncmp( keywords[idx], text + token->start, cursor - token->start )
+                && keywords[idx][cursor - token->start] == '\0' ) token->symbol = keywordSymbols[idx];
+        }
+    } else if( isdigit( (unsigned char) text[cursor] ) ) {
+        if( text[cursor++] != '0' ) while( cursor < end && isdigit( (unsigned char) text[cursor] ) ) cursor++;
+        token->symbol = SYM_NUM;
+        if( cursor - token->start > 10
+            || (cursor - token->start == 10 && strncmp( text + token->start, "2147483647", 10 ) > 0) ) {
+            reportError( "line %d: %.*s is too large (the largest number allowed is 2147483647)",
+                         lineOf( parse, token->start ), (int) (cursor - token->start), text + token->start );
+        }
+    } else {
+        // The operators and punctuation: two characters if possible, otherwise one.
+        char c      = text[cursor++];
+        bool equals = cursor < end && text[cursor] == '=';
+        switch( c ) {
+            case '=':  token->symbol = equals ? SYM_EQ : SYM_BECOMES;  break;
+            case '<':  token->symbol = equals ? SYM_LE : SYM_LT;       break;
+            case '>':  token->symbol = equals ? SYM_GE : SYM_GT;       break;
+            case '!':  token->symbol = equals ? SYM_NE : SYM_UNKNOWN;  break;
+            case '+':  token->symbol = SYM_PLUS;                       break;
+            case '-':  token->symbol = SYM_MINUS;                      break;
+            case '*':  token->symbol = SYM_STAR;                       break;
+            case '/':  token->symbol = SYM_SLASH;                      break;
+            case '%':  token->symbol = SYM_PCT;                        break;
+            case '(':  token->symbol = SYM_LPAREN;                     break;
+            case ')':  token->symbol = SYM_RPAREN;                     break;
+            case '{':  token->symbol = SYM_LBRACE;                     break;
+            case '}':  token->symbol = SYM_RBRACE;                     break;
+            case ',':  token->symbol = SYM_COMMA;                      break;
+            case ';':  token->symbol = SYM_SEMI;                       break;
+            case '\r':
+                reportError( "line %d: carriage returns aren't valid in WL programs (remove them with dos2unix)",
+                             lineOf( parse, token->start ) );
+                break;                                      // Not reached: reportError(...) never returns.
+            default:   token->symbol = SYM_UNKNOWN;                    break;
+        }
+        if( equals && (c == '=' || c == '<' || c == '>' || c == '!') ) cursor++;
+        if( token->symbol == SYM_UNKNOWN ) {
+            reportError( "line %d: unexpected character '%c'", lineOf( parse, token->start ), c );
+        }
+    }
+    token->length = cursor - token->start;
+    *pos          = cursor;
+}
+
+// The SLR(1) parse tables. parseTable[state][sym] is, for a terminal sym (or LR_END, the end of the input),
+// the action to take on seeing it - to shift it and go to state s (s + 1), to reduce by rule r (-(r + 1)), or
+// LR_ERROR - and for a non-terminal sym the state to go to (again as s + 1) after reducing to it.
+#define MAX_LR_STATES      128
+#define MAX_LR_ITEMS       256
+#define LR_END             NUM_SYMBOLS
+#define LR_ERROR           0
+
+short parseTable[MAX_LR_STATES][NUM_SYMBOLS + 1];
+int   nParseStates = 0;                                    // 0 until buildParseTables(...) has been called.
+
+// An LR(0) item - a rule with a dot somewhere in its RHS - is numbered itemBase[rule] + (# of symbols before
+// the dot). A state is a set of items, represented as an array of flags indexed by item #.
+int itemBase[NUM_RULES + 1];
+
+// Add to items every item rule --> . rhs for a non-terminal that some item of it has the dot in front of.
+void closeItems( unsigned char * items ) {
+    bool changed = true;
+    int  rule, dot, other;
+    while( changed ) {
+        changed = false;
+        for( rule = 0; rule < NUM_RULES; rule++ ) {
+            for( dot = 0; dot < grammar[rule].rhsLength; dot++ ) {
+                SymbolId next = grammar[rule].rhs[dot];
+                if( ! items[itemBase[rule] + dot] || isTerminal(next) ) continue;
+                for( other = 0; other < NUM_RULES; other++ ) {
+                    if( grammar[other].lhs == next && ! items[itemBase[other]] ) {
+                        items[itemBase[other]] = 1;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Build the tables from grammar[] by the textbook SLR(1) construction: the states are the canonical
+// collection of sets of LR(0) items, and a state reduces by a completed rule on each terminal that can
+// follow the rule's LHS.
+void buildParseTables( void ) {
+
+    static unsigned char states[MAX_LR_STATES][MAX_LR_ITEMS];
+    bool                 nullable[NUM_SYMBOLS];
+    unsigned long long   first[NUM_SYMBOLS];               // Bit t is set for each terminal t (or LR_END) in the
+    unsigned long long   follow[NUM_SYMBOLS];              // set.
+    bool                 changed = true;
+    int                  nStates = 1;
+    int                  rule, idx, sym, state;
+
+    itemBase[0] = 0;
+    for( rule = 0; rule < NUM_RULES; rule++ ) itemBase[rule+1] = itemBase[rule] + grammar[rule].rhsLength + 1;
+    if( itemBase[NUM_RULES] > MAX_LR_ITEMS ) panicExit( "the WL grammar has too many items" );
+
+    // FIRST and FOLLOW.
+    for( sym = 0; sym < NUM_SYMBOLS; sym++ ) {
+        nullable[sym] = false;
+        first[sym]    = isTerminal(sym) ? 1ull << sym : 0;
+        follow[sym]   = sym == SYM_S ? 1ull << LR_END : 0;
+    }
+    while( changed ) {
+        changed = false;
+        for( rule = 0; rule < NUM_RULES; rule++ ) {
+            Rule               * r     = &grammar[rule];
+            unsigned long long   old   = first[r->lhs];
+            unsigned long long   after = follow[r->lhs];   // What can follow the part of the RHS after idx.
+            bool                 empty = true;
+
+            for( idx = 0; idx < r->rhsLength && empty; idx++ ) {
+                first[r->lhs] |= first[r->rhs[idx]];
+                empty          = nullable[r->rhs[idx]];
+            }
+            if( first[r->lhs] != old || (empty && ! nullable[r->lhs]) ) changed = true;
+            if( empty ) nullable[r->lhs] = true;
+
+            for( idx = r->rhsLength - 1; idx >= 0; idx-- ) {
+                sym = r->rhs[idx];
+                if( ! isTerminal(sym) && (follow[sym] | after) != follow[sym] ) {
+                    follow[sym] |= after;
+                    changed      = true;
+                }
+                after = nullable[sym] ? after | first[sym] : first[sym];
+            }
+        }
+    }
+
+    // The states, starting from the closure of S --> . BOF procedure EOF.
+    memset( states[0], 0, MAX_LR_ITEMS );
+    states[0][itemBase[RULE_S]] = 1;
+    closeItems( states[0] );
+    memset( parseTable, 0, sizeof(parseTable) );
+
+    for( state = 0; state < nStates; state++ ) {
+        for( sym = 0; sym < NUM_SYMBOLS; sym++ ) {
+            unsigned char next[MAX_LR_ITEMS];
+            bool          any = false;
+            int           target;
+
+            memset( next, 0, sizeof(next) );
+            for( rule = 0; rule < NUM_RULES; rule++ ) {
+                for( idx = 0; idx < grammar[rule].rhsLength; idx++ ) {
+                    if( states[state][itemBase[rule] + idx] && grammar[rule].rhs[idx] == sym ) {
+                        next[itemBase[rule] + idx + 1] = 1;
+                        any = true;
+                    }
+                }
+            }
+            if( ! any ) continue;
+            closeItems( next );
+            for( target = 0; target < nStates && memcmp( states[target], next, MAX_LR_ITEMS ); target++ ) ;
+            if( target == nStates ) {
+                if( nStates == MAX_LR_STATES ) panicExit( "the WL grammar has too many LR states" );
+                memcpy( states[nStates++], next, MAX_LR_ITEMS );
+            }
+            parseTable[state][sym] = target + 1;
+        }
+        for( rule = 0; rule < NUM_RULES; rule++ ) {
+            if( ! states[state][itemBase[rule] + grammar[rule].rhsLength] ) continue;
+            for( sym = 0; sym <= LR_END; sym++ ) {
+                if( ! (follow[grammar[rule].lhs] >> sym & 1) ) continue;
+                if( parseTable[state][sym] != LR_ERROR ) panicExit( "the WL grammar isn't SLR(1)" );
+                parseTable[state][sym] = -(rule + 1);
+            }
+        }
+    }
+    nParseStates = nStates;
+}
+
+// Make room for count more elements of size bytes in *array, which has room for *max and is allocated from
+// parse's arena, doubling it if it's full.
+void * reserveArray( ParseTree * parse, void * array, int * max, int used, int count, size_t size ) {
+    if( used + count > *max ) {
+        int newMax = *max ? 2 * *max : 1024;
+        if( newMax < used + count ) newMax = used + count;
+        array = arenaGrow( &parse->arena, array, *max * size, newMax * size );
+        *max  = newMax;
+    }
+    return array;
+}
+
+// If the input already loaded into parse->text (see readParse(...)) is WL source rather than a *.wli file,
+// scan and parse it, building its parse tree in parse, and return true; otherwise return false.
+bool parseSource( ParseTree * parse ) {
+
+    char   * text     = parse->text;
+    size_t   pos      = 0;
+    Tree   * built    = NULL;          // The nodes, in the order they're built; children are indices into ...
+    int    * kids     = NULL;          // ... kids[.firstChild] ... kids[.firstChild + .nChildren - 1].
+    int    * stack    = NULL;          // (state, index in built of the node for it) pairs.
+    int    * source   = NULL;          // source[idx] is the index in built of the node placed in slot idx.
+    int      nBuilt   = 0, maxBuilt = 0;
+    int      nKids    = 0, maxKids  = 0;
+    int      depth    = 0, maxDepth = 0;
+    bool     atEnd    = false;         // Whether the EOF has been shifted.
+    Token    token    = { SYM_BOF, 0, 0 };
+    int      child;
+
+    while( pos < parse->textLength && (text[pos] == ' ' || text[pos] == '\t') ) pos++;
+    if( pos < parse->textLength && text[pos] == 'S'
+        && (pos + 1 == parse->textLength || isspace( (unsigned char) text[pos+1] )) ) return false;
+
+    if( nParseStates == 0 ) buildParseTables();
+    pos   = 0;
+    stack = reserveArray( parse, stack, &maxDepth, 2 * depth, 2, sizeof(int) );
+    stack[2 * depth]     = 0;
+    stack[2 * depth + 1] = -1;
+    depth++;
+
+    for( ;; ) {
+        int lookahead = atEnd ? LR_END : token.symbol;
+        int action    = parseTable[stack[2 * (depth - 1)]][lookahead];
+        int node      = nBuilt;
+
+        built = reserveArray( parse, built, &maxBuilt, nBuilt, 1, sizeof(Tree) );
+        nBuilt++;
+        if( action > 0 ) {
+            built[node].ruleId       = RULE_TERMINAL;
+            built[node].symbol       = token.symbol;
+            built[node].nChildren    = 0;
+            built[node].firstChild   = 0;
+            built[node].lexeme       = token.start;                 // BOF and EOF have empty lexemes.
+            built[node].lexemeLength = token.length;
+            if( token.symbol == SYM_EOF ) {
+                atEnd = true;
+            } else {
+                scanToken( parse, &pos, &token );
+            }
+        } else if( action < 0 ) {
+            RuleId   ruleId = -action - 1;
+            Rule   * rule   = &grammar[ruleId];
+
+            kids = reserveArray( parse, kids, &maxKids, nKids, rule->rhsLength, sizeof(int) );
+            built[node].ruleId       = ruleId;
+            built[node].symbol       = rule->lhs;
+            built[node].nChildren    = rule->rhsLength;
+            built[node].firstChild   = nKids;
+            built[node].lexeme       = NO_LEXEME;
+            built[node].lexemeLength = 0;
+            depth -= rule->rhsLength;
+            for( child = 0; child < rule->rhsLength; child++ ) kids[nKids++] = stack[2 * (depth + child) + 1];
+            stats.ruleMatches++;
+            if( ruleId == RULE_S ) break;                          // Accept.
+            action = parseTable[stack[2 * (depth - 1)]][rule->lhs];
+        } else if( atEnd || token.symbol == SYM_EOF ) {
+            reportError( "line %d: unexpected end of input", lineOf( parse, token.start ) );
+        } else {
+            reportError( "line %d: unexpected %s %.*s", lineOf( parse, token.start ),
+                         symbolNames[token.symbol], token.length, text + token.start );
+        }
+        stack = reserveArray( parse, stack, &maxDepth, 2 * depth, 2, sizeof(int) );
+        stack[2 * depth]     = action - 1;
+        stack[2 * depth + 1] = node;
+        depth++;
+    }
+
+    // Lay the nodes out just as readParse(...) would have: the root (which was built last) in slot 0, and the
+    // children of each node in consecutive slots reserved when the node is placed, in preorder.
+    parse->nodes    = arenaAlloc( &parse->arena, nBuilt * sizeof(Tree) );
+    parse->maxNodes = nBuilt;
+    source          = arenaAlloc( &parse->arena, nBuilt * sizeof(int) );
+    allocNodes( parse, 1 );
+    source[0] = nBuilt - 1;
+    pushWork( parse, &parse->nodes[0] );
+    while( parse->nWork > 0 ) {
+        TreePtr  tree = popWork( parse );
+        int      node = tree - parse->nodes;
+        Tree   * from = &built[source[node]];
+
+        *tree = *from;
+        if( from->ruleId != RULE_TERMINAL ) {
+            int first = allocNodes( parse, from->nChildren );
+            tree = &parse->nodes[node];
+            tree->firstChild = first;
+            for( child = from->nChildren - 1; child >= 0; child-- ) {
+                source[first + child] = kids[from->firstChild + child];
+                pushWork( parse, &parse->nodes[first + child] );
+            }
+        }
+    }
+    return true;
+}
+
+// Write the parse tree to out as a *.wli file, just as java cs241.WLParse would: one line per node in
+// preorder, giving the rule for a non-terminal and the symbol and lexeme for a terminal.
+void writeTextParse( ParseTree * parse, Emitter * out ) {
+    int child;
+    pushWork( parse, &parse->nodes[0] );
+    while( parse->nWork > 0 ) {
+        TreePtr tree = popWork( parse );
+        if( tree->ruleId == RULE_TERMINAL && tree->lexemeLength == 0 ) {
+            emit( out, "%s %s\n", symbolNames[tree->symbol], symbolNames[tree->symbol] );    // BOF or EOF.
+        } else if( tree->ruleId == RULE_TERMINAL ) {
+            emit( out, "%s %.*s\n", symbolNames[tree->symbol], tree->lexemeLength, lexemeOf(parse,tree) );
+        } else {
+            emitString( out, ruleTexts[tree->ruleId] );
+            emitBytes( out, "\n", 1 );
+        }
+        for( child = tree->nChildren - 1; child >= 0; child-- ) pushWork( parse, childOf(parse,tree,child) );
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Pass two - building a symbol table.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Report an error concerning the variable named by tree (an ID leaf).
+void variableError( ParseTree * parse, TreePtr tree, char * message ) {
+    reportError( "%s %.*s", message, tree->lexemeLength, lexemeOf(parse,tree) );
+}
+
+/* Build the symbol table for the program by walking its parse tree: declare the variables tree declares
+   in table, and check that every variable it uses has been declared. */
+void symbolsDeclaredIn( ParseTree * parse, TreePtr tree, SymbolTable * table ) {
+
+    int base = parse->nWork;
+
+    switch( tree->ruleId ) {
+
+        case RULE_S:
+            /* Recurse on procedure */
+            symbolsDeclaredIn( parse, childOf(parse,tree,1), table );
+            return;
+
+        case RULE_PROCEDURE:
+            /* Recurse on dcl and dcl, then on the dcls, statements and the returned expr */
+            symbolsDeclaredIn( parse, childOf(parse,tree,3),  table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,5),  table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,8),  table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,9),  table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,11), table );
+            return;
+
+        case RULE_DCLS:
+        case RULE_DCLS_EMPTY:
+            /* Recurse on each dcl, in order */
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) symbolsDeclaredIn( parse, childOf(parse,popWork(parse),1), table );
+            return;
+
+        case RULE_DCL: {
+            TreePtr id = childOf( parse, tree, 1 );
+            if( declareSymbol( table, lexemeOf(parse,id), id->lexemeLength, SYM_INT ) == NULL ) {
+                variableError( parse, id, "duplicate declaration of" );
+            }
+            return;
+        }
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            /* Recurse on each statement, in order */
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) symbolsDeclaredIn( parse, childOf(parse,popWork(parse),1), table );
+            return;
+
+        case RULE_STATEMENT_ASSIGN:
+            symbolsDeclaredIn( parse, childOf(parse,tree,0), table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,2), table );
+            return;
+
+        case RULE_STATEMENT_IF:
+            symbolsDeclaredIn( parse, childOf(parse,tree,2), table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,5), table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,9), table );
+            return;
+
+        case RULE_STATEMENT_WHILE:
+            symbolsDeclaredIn( parse, childOf(parse,tree,2), table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,5), table );
+            return;
+
+        case RULE_STATEMENT_PRINTLN:
+            table->usesPrintln = true;
+            symbolsDeclaredIn( parse, childOf(parse,tree,2), table );
+            return;
+
+        case RULE_TEST_EQ: case RULE_TEST_NE: case RULE_TEST_LT:
+        case RULE_TEST_LE: case RULE_TEST_GE: case RULE_TEST_GT:
+            symbolsDeclaredIn( parse, childOf(parse,tree,0), table );
+            symbolsDeclaredIn( parse, childOf(parse,tree,2), table );
+            return;
+
+        case RULE_EXPR_TERM:   case RULE_EXPR_PLUS:  case RULE_EXPR_MINUS:
+        case RULE_TERM_FACTOR: case RULE_TERM_STAR:  case RULE_TERM_SLASH: case RULE_TERM_PCT:
+            /* Recurse on the leftmost operand, then on the right operand of each operator, in order */
+            symbolsDeclaredIn( parse, childOf(parse,pushLeftSpine(parse,tree),0), table );
+            while( parse->nWork > base ) symbolsDeclaredIn( parse, childOf(parse,popWork(parse),2), table );
+            return;
+
+        case RULE_FACTOR_ID:
+        case RULE_LVALUE_ID: {
+            TreePtr id = childOf( parse, tree, 0 );
+            if( lookupSymbol( table, lexemeOf(parse,id), id->lexemeLength ) == NULL ) {
+                variableError( parse, id, "use of undeclared variable" );
+            }
+            return;
+        }
+
+        case RULE_FACTOR_NUM:
+            return;
+
+        case RULE_FACTOR_PARENS:
+        case RULE_LVALUE_PARENS:
+            symbolsDeclaredIn( parse, childOf(parse,tree,1), table );
+            return;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Pass three - code generation.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Register conventions used by the generated code:
+//
+//     $1, $2   the parameters of wain (copied into the frame by the prologue)
+//     $3       the value of the expression most recently evaluated; wain's result
+//     $4       the constant 4
+//     $5 - $7  scratch
+//     $10      the address of the print routine, when the program contains println
+//     $11      the constant 1
+//     $29      the frame pointer (see the symbol table)
+//     $30      the stack pointer; temporaries are pushed below the frame
+//     $31      the return address
+//
+// and, with -O (see "Register allocation" below):
+//
+//     $9       wain's return address, while println calls print
+//     $12-$17  temporaries - the left operands of operators - until there are too many to fit
+//     $18-$28  variables
+//
+// print then preserves only these, rather than every register.
+
+#define FIRST_TEMP_REG     12
+#define NUM_TEMP_REGS      6
+#define FIRST_VAR_REG      18
+#define NUM_VAR_REGS       11
+
+int tempsInUse = 0;                   // # of temporaries held in registers.
+
+// The value of a NUM leaf, which the scanner (ours or WLScan) guarantees is at most 2147483647.
+int numberOf( ParseTree * parse, TreePtr tree ) {
+    char     * digits = lexemeOf( parse, tree );
+    unsigned   value  = 0;
+    int        idx;
+    for( idx = 0; idx < tree->lexemeLength; idx++ ) value = 10 * value + (digits[idx] - '0');
+    return (int) value;
+}
+
+// Symbol for the variable named by the ID leaf tree, which pass two has checked was declared.
+Symbol * symbolFor( ParseTree * parse, TreePtr tree, SymbolTable * symbolTable ) {
+    return lookupSymbol( symbolTable, lexemeOf(parse,tree), tree->lexemeLength );
+}
+
+// Whether sym needs a slot in the frame that is kept up to date.
+bool inFrame( Symbol * sym ) {
+    return ! optimize || (sym->reg == 0 && sym->liveEnd != NOT_LIVE);
+}
+
+// Load the register variables first used in top-level statement number statement of wain with their initial
+// values. *nextLive is the index in table->live of the first variable not yet loaded.
+void emitRegisterInits( SymbolTable * table, int statement, int * nextLive, Emitter * out ) {
+    for( ; *nextLive < table->nLive && table->live[*nextLive]->initBefore <= statement; (*nextLive)++ ) {
+        Symbol * sym = table->live[*nextLive];
+        if( sym->reg != 0 && sym->initBefore != INIT_IN_PROLOGUE ) emit( out, "lis $%d\n.word %d\n", sym->reg, sym->value );
+    }
+}
+
+void emitPush( Emitter * out, int reg ) {
+    emit( out, "sw $%d,-4($30)\nsub $30,$30,$4\n", reg );
+}
+
+void emitPop( Emitter * out, int reg ) {
+    emit( out, "add $30,$30,$4\nlw $%d,-4($30)\n", reg );
+}
+
+// Save $3, the value of an operator's left operand, while its right operand is evaluated. Returns the register
+// the value will be in once restoreOperand(...) is called: with -O a temporary register if there's one free,
+// otherwise $5, with the value pushed on the stack meanwhile.
+int saveOperand( Emitter * out ) {
+    int reg;
+    if( optimize && tempsInUse < NUM_TEMP_REGS ) {
+        reg = FIRST_TEMP_REG + tempsInUse++;
+        emit( out, "add $%d,$3,$0\n", reg );
+        return reg;
+    }
+    emitPush( out, 3 );
+    return 5;
+}
+
+void restoreOperand( Emitter * out, int reg ) {
+    if( reg == 5 ) emitPop( out, 5 );
+    else tempsInUse--;
+}
+
+// With -O, the register holding the value of tree - an expr, term or factor - if it's simply a variable that
+// has a register of its own; otherwise 0.
+int registerFor( ParseTree * parse, TreePtr tree, SymbolTable * symbolTable ) {
+    if( ! optimize ) return 0;
+    for( ;; ) {
+        switch( tree->ruleId ) {
+            case RULE_EXPR_TERM:
+            case RULE_TERM_FACTOR:    tree = childOf( parse, tree, 0 );                                  break;
+            case RULE_FACTOR_PARENS:  tree = childOf( parse, tree, 1 );                                  break;
+            case RULE_FACTOR_ID:      return symbolFor( parse, childOf(parse,tree,0), symbolTable )->reg;
+            default:                  return 0;
+        }
+    }
+}
+
+// Evaluate the right operand of op (an operator or a test), whose left operand's value is in $3. Returns the
+// register holding the left operand's value afterwards; *right is set to the one holding the right's.
+int generateOperands( ParseTree * parse, TreePtr op, SymbolTable * symbolTable, Emitter * out, int * right ) {
+    int left;
+    *right = registerFor( parse, childOf(parse,op,2), symbolTable );
+    if( *right != 0 ) return 3;
+    left = saveOperand( out );
+    generateCodeFor( parse, childOf(parse,op,2), symbolTable, out );
+    restoreOperand( out, left );
+    *right = 3;
+    return left;
+}
+
+// Load or store register reg from or to the frame slot of sym. lw and sw can only reach 32768 bytes below $29,
+// so beyond that the address is computed in register scratch first.
+void emitLoad( Emitter * out, int reg, Symbol * sym ) {
+    if( sym->offset >= -32768 ) {
+        emit( out, "lw $%d,%d($29)\n", reg, sym->offset );
+    } else {
+        emit( out, "lis $%d\n.word %d\nadd $%d,$29,$%d\nlw $%d,0($%d)\n", reg, sym->offset, reg, reg, reg, reg );
+    }
+}
+
+void emitStore( Emitter * out, int reg, Symbol * sym, int scratch ) {
+    if( sym->offset >= -32768 ) {
+        emit( out, "sw $%d,%d($29)\n", reg, sym->offset );
+    } else {
+        emit( out, "lis $%d\n.word %d\nadd $%d,$29,$%d\nsw $%d,0($%d)\n", scratch, sym->offset, scratch, scratch, reg, scratch );
+    }
+}
+
+// Prints the integer in $1 in decimal, followed by a newline, preserving every register but $31.
+// Digits are produced least significant first with divu (so that -2147483648 works too) and stacked
+// below $30, then written out most significant first.
+char * printRoutine =
+    "print:\n"
+    "sw $1,-4($30)\n"     "sw $2,-8($30)\n"     "sw $3,-12($30)\n"    "sw $4,-16($30)\n"
+    "sw $5,-20($30)\n"    "sw $6,-24($30)\n"    "sw $7,-28($30)\n"    "sw $8,-32($30)\n"
+    "lis $3\n"            ".word 32\n"          "sub $30,$30,$3\n"
+    "lis $4\n"            ".word 0xffff000c\n"
+    "lis $5\n"            ".word 10\n"
+    "lis $6\n"            ".word 4\n"
+    "add $2,$1,$0\n"
+    "slt $3,$1,$0\n"
+    "beq $3,$0,printPositive\n"
+    "lis $3\n"            ".word 45\n"          "sw $3,0($4)\n"
+    "sub $2,$0,$1\n"
+    "printPositive:\n"
+    "add $3,$30,$0\n"
+    "printDigits:\n"
+    "divu $2,$5\n"        "mfhi $7\n"           "sub $3,$3,$6\n"      "sw $7,0($3)\n"
+    "mflo $2\n"
+    "bne $2,$0,printDigits\n"
+    "lis $8\n"            ".word 48\n"
+    "printOut:\n"
+    "lw $7,0($3)\n"       "add $7,$7,$8\n"      "sw $7,0($4)\n"       "add $3,$3,$6\n"
+    "bne $3,$30,printOut\n"
+    "sw $5,0($4)\n"
+    "lis $3\n"            ".word 32\n"          "add $30,$30,$3\n"
+    "lw $1,-4($30)\n"     "lw $2,-8($30)\n"     "lw $3,-12($30)\n"    "lw $4,-16($30)\n"
+    "lw $5,-20($30)\n"    "lw $6,-24($30)\n"    "lw $7,-28($30)\n"    "lw $8,-32($30)\n"
+    "jr $31\n";
+
+// The same for -O, which needs only $4 and $9 - $29 preserved, so there is nothing to save and restore.
+char * printRoutineOptimized =
+    "print:\n"
+    "lis $5\n"            ".word 0xffff000c\n"
+    "lis $6\n"            ".word 10\n"
+    "add $2,$1,$0\n"
+    "slt $3,$1,$0\n"
+    "beq $3,$0,printPositive\n"
+    "lis $3\n"            ".word 45\n"          "sw $3,0($5)\n"
+    "sub $2,$0,$1\n"
+    "printPositive:\n"
+    "add $3,$30,$0\n"
+    "printDigits:\n"
+    "divu $2,$6\n"        "mfhi $7\n"           "sub $3,$3,$4\n"      "sw $7,0($3)\n"
+    "mflo $2\n"
+    "bne $2,$0,printDigits\n"
+    "lis $8\n"            ".word 48\n"
+    "printOut:\n"
+    "lw $7,0($3)\n"       "add $7,$7,$8\n"      "sw $7,0($5)\n"       "add $3,$3,$4\n"
+    "bne $3,$30,printOut\n"
+    "sw $6,0($5)\n"
+    "jr $31\n";
+
+/* Generate the code for the parse tree, appending it to out. */
+void generateCodeFor( ParseTree * parse, TreePtr tree, SymbolTable * symbolTable, Emitter * out ) {
+
+    int base = parse->nWork;
+    int label, left, right;
+
+    switch( tree->ruleId ) {
+
+        case RULE_S:
+            generateCodeFor( parse, childOf(parse,tree,1), symbolTable, out );
+            emitString( out, "jr $31\n" );
+            if( symbolTable->usesPrintln ) emitString( out, optimize ? printRoutineOptimized : printRoutine );
+            return;
+
+        case RULE_PROCEDURE: {
+            Symbol * a = symbolFor( parse, childOf(parse,childOf(parse,tree,3),1), symbolTable );
+            Symbol * b = symbolFor( parse, childOf(parse,childOf(parse,tree,5),1), symbolTable );
+
+            // Prologue: set up the constants and the frame, then copy the parameters and the initial values
+            // of the dcls into it - or, with -O, into their registers if they have them.
+            emitString( out, "lis $4\n.word 4\nlis $11\n.word 1\nsub $29,$30,$4\n" );
+            if( optimize ) {
+                tempsInUse = 0;
+                allocateRegisters( parse, tree, symbolTable );
+                if( symbolTable->usesPrintln ) emitString( out, "add $9,$31,$0\n" );
+                if( a->reg != 0 ) emit( out, "add $%d,$1,$0\n", a->reg );
+                if( b->reg != 0 ) emit( out, "add $%d,$2,$0\n", b->reg );
+            }
+            if( inFrame( a ) ) emitStore( out, 1, a, 5 );
+            if( inFrame( b ) ) emitStore( out, 2, b, 5 );
+            generateCodeFor( parse, childOf(parse,tree,8), symbolTable, out );
+            emit( out, "lis $5\n.word %d\nsub $30,$30,$5\n", 4 * symbolTable->nSymbols );
+            if( symbolTable->usesPrintln ) emitString( out, "lis $10\n.word print\n" );
+
+            if( optimize ) {
+                // Load each register variable just before the top-level statement that first uses it.
+                int nextLive  = 0;
+                int statement = 0;
+                pushLeftSpine( parse, childOf(parse,tree,9) );
+                while( parse->nWork > base ) {
+                    emitRegisterInits( symbolTable, statement++, &nextLive, out );
+                    generateCodeFor( parse, childOf(parse,popWork(parse),1), symbolTable, out );
+                }
+                emitRegisterInits( symbolTable, statement, &nextLive, out );
+            } else {
+                generateCodeFor( parse, childOf(parse,tree,9), symbolTable, out );
+            }
+            generateCodeFor( parse, childOf(parse,tree,11), symbolTable, out );
+
+            // Epilogue: pop the frame.
+            emitString( out, "add $30,$29,$4\n" );
+            if( optimize && symbolTable->usesPrintln ) emitString( out, "add $31,$9,$0\n" );
+            return;
+        }
+
+        case RULE_DCLS:
+        case RULE_DCLS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) {
+                TreePtr  dcls = popWork( parse );
+                Symbol * sym  = symbolFor( parse, childOf(parse,childOf(parse,dcls,1),1), symbolTable );
+                if( ! inFrame( sym ) ) continue;
+                emit( out, "lis $3\n.word %d\n", numberOf( parse, childOf(parse,dcls,3) ) );
+                emitStore( out, 3, sym, 5 );
+            }
+            return;
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) generateCodeFor( parse, childOf(parse,popWork(parse),1), symbolTable, out );
+            return;
+
+        case RULE_STATEMENT_ASSIGN: {
+            TreePtr  lvalue = childOf( parse, tree, 0 );
+            Symbol * sym;
+            while( lvalue->ruleId == RULE_LVALUE_PARENS ) lvalue = childOf( parse, lvalue, 1 );
+            sym = symbolFor( parse, childOf(parse,lvalue,0), symbolTable );
+            generateCodeFor( parse, childOf(parse,tree,2), symbolTable, out );
+            if( inFrame( sym ) ) emitStore( out, 3, sym, 5 );
+            else                 emit( out, "add $%d,$3,$0\n", sym->reg );
+            return;
+        }
+
+        case RULE_STATEMENT_IF:
+            label = out->nLabels++;
+            generateCodeFor( parse, childOf(parse,tree,2), symbolTable, out );
+            emit( out, "beq $3,$0,else%d\n", label );
+            generateCodeFor( parse, childOf(parse,tree,5), symbolTable, out );
+            emit( out, "beq $0,$0,endif%d\nelse%d:\n", label, label );
+            generateCodeFor( parse, childOf(parse,tree,9), symbolTable, out );
+            emit( out, "endif%d:\n", label );
+            return;
+
+        case RULE_STATEMENT_WHILE:
+            label = out->nLabels++;
+            emit( out, "while%d:\n", label );
+            generateCodeFor( parse, childOf(parse,tree,2), symbolTable, out );
+            emit( out, "beq $3,$0,endwhile%d\n", label );
+            generateCodeFor( parse, childOf(parse,tree,5), symbolTable, out );
+            emit( out, "beq $0,$0,while%d\nendwhile%d:\n", label, label );
+            return;
+
+        case RULE_STATEMENT_PRINTLN:
+            generateCodeFor( parse, childOf(parse,tree,2), symbolTable, out );
+            emitString( out, "add $1,$3,$0\n" );
+            if( optimize ) {
+                emitString( out, "jalr $10\n" );                                       // $31 is kept in $9.
+                return;
+            }
+            emitPush( out, 31 );
+            emitString( out, "jalr $10\n" );
+            emitPop( out, 31 );
+            return;
+
+        case RULE_TEST_EQ: case RULE_TEST_NE: case RULE_TEST_LT:
+        case RULE_TEST_LE: case RULE_TEST_GE: case RULE_TEST_GT:
+            // Leaves 1 in $3 if the test holds and 0 otherwise.
+            generateCodeFor( parse, childOf(parse,tree,0), symbolTable, out );
+            left = generateOperands( parse, tree, symbolTable, out, &right );
+            switch( tree->ruleId ) {
+                case RULE_TEST_LT: emit( out, "slt $3,$%d,$%d\n", left, right );                  break;
+                case RULE_TEST_GT: emit( out, "slt $3,$%d,$%d\n", right, left );                  break;
+                case RULE_TEST_GE: emit( out, "slt $3,$%d,$%d\nsub $3,$11,$3\n", left, right );   break;
+                case RULE_TEST_LE: emit( out, "slt $3,$%d,$%d\nsub $3,$11,$3\n", right, left );   break;
+                case RULE_TEST_NE: emit( out, "slt $6,$%d,$%d\nslt $7,$%d,$%d\nadd $3,$6,$7\n", right, left, left, right );                 break;
+                default:           emit( out, "slt $6,$%d,$%d\nslt $7,$%d,$%d\nadd $3,$6,$7\nsub $3,$11,$3\n", right, left, left, right );  break;
+            }
+            return;
+
+        case RULE_EXPR_TERM:   case RULE_EXPR_PLUS:  case RULE_EXPR_MINUS:
+        case RULE_TERM_FACTOR: case RULE_TERM_STAR:  case RULE_TERM_SLASH: case RULE_TERM_PCT:
+            // Evaluate the leftmost operand, then apply each operator in turn to the value so far (which is
+            // saved while the right operand is evaluated) and the right operand.
+            generateCodeFor( parse, leftmostOperand(parse,pushLeftSpine(parse,tree)), symbolTable, out );
+            while( parse->nWork > base ) {
+                TreePtr op = popWork( parse );
+                left = generateOperands( parse, op, symbolTable, out, &right );
+                switch( op->ruleId ) {
+                    case RULE_EXPR_PLUS:  emit( out, "add $3,$%d,$%d\n", left, right );           break;
+                    case RULE_EXPR_MINUS: emit( out, "sub $3,$%d,$%d\n", left, right );           break;
+                    case RULE_TERM_STAR:  emit( out, "mult $%d,$%d\nmflo $3\n", left, right );    break;
+                    case RULE_TERM_SLASH: emit( out, "div $%d,$%d\nmflo $3\n", left, right );     break;
+                    default:              emit( out, "div $%d,$%d\nmfhi $3\n", left, right );     break;
+                }
+            }
+            return;
+
+        case RULE_FACTOR_ID: {
+            Symbol * sym = symbolFor( parse, childOf(parse,tree,0), symbolTable );
+            if( inFrame( sym ) ) emitLoad( out, 3, sym );
+            else                 emit( out, "add $3,$%d,$0\n", sym->reg );
+            return;
+        }
+
+        case RULE_FACTOR_NUM:
+            emit( out, "lis $3\n.word %d\n", numberOf( parse, childOf(parse,tree,0) ) );
+            return;
+
+        case RULE_FACTOR_PARENS:
+            generateCodeFor( parse, childOf(parse,tree,1), symbolTable, out );
+            return;
+
+        case RULE_CONSTANT:
+            emit( out, "lis $3\n.word %d\n", constantOf( tree ) );
+            return;
+
+        case RULE_BLOCK:
+            if( tree->nChildren > 0 ) generateCodeFor( parse, childOf(parse,tree,0), symbolTable, out );
+            return;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Optimizing the parse tree (-O).
+//
+// -----------------------------------------------------------------------------------------------------
+
+// With -O, optimizeTree(...) rewrites the parse tree between passes two and three so that there is less for
+// pass three to translate:
+//
+// (1) An expr, term or factor whose value is known at compile time - eg 3 * (4 + 5) - becomes a RULE_CONSTANT
+// leaf, its value worked out with the same 32-bit arithmetic the generated code would use. A division or
+// remainder by zero, or -2147483648 / -1, is left for run time.
+//
+// (2) An if statement whose test is constant becomes a RULE_BLOCK holding just the statements of the arm that
+// is taken. A while loop whose test is constant and false becomes an empty RULE_BLOCK.
+//
+// (3) An assignment to a variable whose value is never read, other than by assignments to the variable itself,
+// becomes an empty RULE_BLOCK. Removing one can leave another variable unread, so this is repeated until
+// there is nothing more to remove.
+
+// Make tree, an expr, term or factor, a RULE_CONSTANT leaf with the given value.
+void makeConstant( TreePtr tree, int value ) {
+    tree->ruleId       = RULE_CONSTANT;
+    tree->nChildren    = 0;
+    tree->lexeme       = value;
+    tree->lexemeLength = 0;
+}
+
+// Make tree, a statement, a RULE_BLOCK holding statements - or nothing at all, if statements is NULL.
+void makeBlock( ParseTree * parse, TreePtr tree, TreePtr statements ) {
+    tree->ruleId    = RULE_BLOCK;
+    tree->nChildren = statements != NULL ? 1 : 0;
+    if( statements != NULL ) tree->firstChild = statements - parse->nodes;
+}
+
+// Apply op - the rule of an operator or of a test - to left and right as the generated code would, putting the
+// result (1 or 0 for a test) in *result. Returns false if the result has to be left to run time.
+bool applyOperator( RuleId op, int left, int right, int * result ) {
+    unsigned a = left, b = right;
+    switch( op ) {
+        case RULE_EXPR_PLUS:  *result = (int) (a + b);  return true;
+        case RULE_EXPR_MINUS: *result = (int) (a - b);  return true;
+        case RULE_TERM_STAR:  *result = (int) (a * b);  return true;
+        case RULE_TERM_SLASH:
+        case RULE_TERM_PCT:
+            if( right == 0 || (left == INT_MIN && right == -1) ) return false;
+            *result = op == RULE_TERM_SLASH ? left / right : left % right;         // Both round towards 0, like div.
+            return true;
+        case RULE_TEST_EQ:    *result = left == right;  return true;
+        case RULE_TEST_NE:    *result = left != right;  return true;
+        case RULE_TEST_LT:    *result = left <  right;  return true;
+        case RULE_TEST_LE:    *result = left <= right;  return true;
+        case RULE_TEST_GE:    *result = left >= right;  return true;
+        case RULE_TEST_GT:    *result = left >  right;  return true;
+        default:              return false;
+    }
+}
+
+/* Fold the constants in tree, and drop the arms of if and while statements that can never run, as in (1) and
+   (2) above. Returns true if tree is a test, expr, term or factor whose value is constant, with the value in
+   *value; an expr, term or factor that is constant has been made a RULE_CONSTANT. */
+bool foldConstants( ParseTree * parse, TreePtr tree, int * value ) {
+
+    int  base = parse->nWork;
+    int  left, right;
+    bool constant;
+
+    switch( tree->ruleId ) {
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) foldConstants( parse, childOf(parse,popWork(parse),1), value );
+            return false;
+
+        case RULE_STATEMENT_ASSIGN:
+            foldConstants( parse, childOf(parse,tree,2), value );
+            return false;
+
+        case RULE_STATEMENT_IF:
+            if( foldConstants( parse, childOf(parse,tree,2), value ) ) {
+                makeBlock( parse, tree, childOf(parse,tree,*value ? 5 : 9) );
+                foldConstants( parse, childOf(parse,tree,0), value );
+                return false;
+            }
+            foldConstants( parse, childOf(parse,tree,5), value );
+            foldConstants( parse, childOf(parse,tree,9), value );
+            return false;
+
+        case RULE_STATEMENT_WHILE:
+            if( foldConstants( parse, childOf(parse,tree,2), value ) && ! *value ) {
+                makeBlock( parse, tree, NULL );
+                return false;
+            }
+            foldConstants( parse, childOf(parse,tree,5), value );
+            return false;
+
+        case RULE_STATEMENT_PRINTLN:
+            foldConstants( parse, childOf(parse,tree,2), value );
+            return false;
+
+        case RULE_TEST_EQ: case RULE_TEST_NE: case RULE_TEST_LT:
+        case RULE_TEST_LE: case RULE_TEST_GE: case RULE_TEST_GT:
+            constant = foldConstants( parse, childOf(parse,tree,0), &left );
+            constant = foldConstants( parse, childOf(parse,tree,2), &right ) && constant;
+            return constant && applyOperator( tree->ruleId, left, right, value );
+
+        case RULE_EXPR_TERM:   case RULE_EXPR_PLUS:  case RULE_EXPR_MINUS:
+        case RULE_TERM_FACTOR: case RULE_TERM_STAR:  case RULE_TERM_SLASH: case RULE_TERM_PCT:
+            // As long as the value so far is constant, each operator whose right operand is constant can be
+            // folded too; the first that can't be leaves the ones above it to run time.
+            constant = foldConstants( parse, leftmostOperand(parse,pushLeftSpine(parse,tree)), &left );
+            while( parse->nWork > base ) {
+                TreePtr op = popWork( parse );
+                constant = foldConstants( parse, childOf(parse,op,2), &right ) && constant;
+                constant = constant && applyOperator( op->ruleId, left, right, &left );
+                if( constant ) makeConstant( op, left );
+            }
+            if( constant ) makeConstant( tree, left );
+            *value = left;
+            return constant;
+
+        case RULE_FACTOR_NUM:
+            makeConstant( tree, numberOf( parse, childOf(parse,tree,0) ) );
+            *value = constantOf( tree );
+            return true;
+
+        case RULE_FACTOR_PARENS:
+            if( ! foldConstants( parse, childOf(parse,tree,1), value ) ) return false;
+            makeConstant( tree, *value );
+            return true;
+
+        case RULE_CONSTANT:
+            *value = constantOf( tree );
+            return true;
+
+        case RULE_FACTOR_ID:
+            return false;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+    return false;
+}
+
+/* Add delta to the # of reads of each variable that tree reads, except for reads of except (see (3) above). */
+void countReads( ParseTree * parse, TreePtr tree, SymbolTable * table, Symbol * except, int delta ) {
+
+    int      base = parse->nWork;
+    Symbol * sym;
+
+    switch( tree->ruleId ) {
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) countReads( parse, childOf(parse,popWork(parse),1), table, except, delta );
+            return;
+
+        case RULE_STATEMENT_ASSIGN: {
+            TreePtr lvalue = childOf( parse, tree, 0 );
+            while( lvalue->ruleId == RULE_LVALUE_PARENS ) lvalue = childOf( parse, lvalue, 1 );
+            countReads( parse, childOf(parse,tree,2), table, symbolFor( parse, childOf(parse,lvalue,0), table ), delta );
+            return;
+        }
+
+        case RULE_STATEMENT_IF:
+            countReads( parse, childOf(parse,tree,2), table, except, delta );
+            countReads( parse, childOf(parse,tree,5), table, except, delta );
+            countReads( parse, childOf(parse,tree,9), table, except, delta );
+            return;
+
+        case RULE_STATEMENT_WHILE:
+            countReads( parse, childOf(parse,tree,2), table, except, delta );
+            countReads( parse, childOf(parse,tree,5), table, except, delta );
+            return;
+
+        case RULE_STATEMENT_PRINTLN:
+            countReads( parse, childOf(parse,tree,2), table, except, delta );
+            return;
+
+        case RULE_TEST_EQ: case RULE_TEST_NE: case RULE_TEST_LT:
+        case RULE_TEST_LE: case RULE_TEST_GE: case RULE_TEST_GT:
+            countReads( parse, childOf(parse,tree,0), table, except, delta );
+            countReads( parse, childOf(parse,tree,2), table, except, delta );
+            return;
+
+        case RULE_EXPR_TERM:   case RULE_EXPR_PLUS:  case RULE_EXPR_MINUS:
+        case RULE_TERM_FACTOR: case RULE_TERM_STAR:  case RULE_TERM_SLASH: case RULE_TERM_PCT:
+            countReads( parse, leftmostOperand(parse,pushLeftSpine(parse,tree)), table, except, delta );
+            while( parse->nWork > base ) countReads( parse, childOf(parse,popWork(parse),2), table, except, delta );
+            return;
+
+        case RULE_FACTOR_ID:
+            sym = symbolFor( parse, childOf(parse,tree,0), table );
+            if( sym != except ) sym->reads += delta;
+            return;
+
+        case RULE_FACTOR_PARENS:
+            countReads( parse, childOf(parse,tree,1), table, except, delta );
+            return;
+
+        case RULE_BLOCK:
+            if( tree->nChildren > 0 ) countReads( parse, childOf(parse,tree,0), table, except, delta );
+            return;
+
+        case RULE_CONSTANT:
+            return;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+}
+
+/* Remove the assignments in tree, a statement or statements, to variables that are never read. Returns true if
+   it removed any. */
+bool removeDeadStores( ParseTree * parse, TreePtr tree, SymbolTable * table ) {
+
+    int  base    = parse->nWork;
+    bool removed = false;
+
+    switch( tree->ruleId ) {
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) removed = removeDeadStores( parse, childOf(parse,popWork(parse),1), table ) || removed;
+            return removed;
+
+        case RULE_STATEMENT_ASSIGN: {
+            TreePtr  lvalue = childOf( parse, tree, 0 );
+            Symbol * sym;
+            while( lvalue->ruleId == RULE_LVALUE_PARENS ) lvalue = childOf( parse, lvalue, 1 );
+            sym = symbolFor( parse, childOf(parse,lvalue,0), table );
+            if( sym->reads > 0 ) return false;
+            countReads( parse, childOf(parse,tree,2), table, sym, -1 );
+            makeBlock( parse, tree, NULL );
+            return true;
+        }
+
+        case RULE_STATEMENT_IF:
+            removed = removeDeadStores( parse, childOf(parse,tree,5), table );
+            return removeDeadStores( parse, childOf(parse,tree,9), table ) || removed;
+
+        case RULE_STATEMENT_WHILE:
+            return removeDeadStores( parse, childOf(parse,tree,5), table );
+
+        case RULE_BLOCK:
+            return tree->nChildren > 0 && removeDeadStores( parse, childOf(parse,tree,0), table );
+
+        case RULE_STATEMENT_PRINTLN:
+            return false;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+    return false;
+}
+
+/* Optimize the parse tree rooted at tree, as described above. */
+void optimizeTree( ParseTree * parse, TreePtr tree, SymbolTable * table ) {
+
+    TreePtr  procedure  = childOf( parse, tree, 1 );
+    TreePtr  statements = childOf( parse, procedure, 9 );
+    TreePtr  returned   = childOf( parse, procedure, 11 );
+    int      value, slot;
+
+    foldConstants( parse, statements, &value );
+    foldConstants( parse, returned,   &value );
+
+    for( slot = 0; slot < table->capacity; slot++ ) table->slots[slot].reads = 0;
+    countReads( parse, statements, table, NULL, 1 );
+    countReads( parse, returned,   table, NULL, 1 );
+    while( removeDeadStores( parse, statements, table ) ) {}
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Register allocation (-O).
+//
+// -----------------------------------------------------------------------------------------------------
+
+// Without -O every variable lives in wain's frame and every temporary is pushed on the stack, so the
+// generated code spends most of its time on lw and sw. With -O, pass three first calls allocateRegisters(...)
+// to give as many variables as it can a register of their own for as long as they are live:
+//
+// (1) The statements are walked in order, numbering the "points" at which variables are used (read or
+// written). A variable is live from the start of the top-level statement of wain in which it is first used
+// until its last use - or, if that is inside a while loop, until the end of the outermost loop, since the
+// loop may go round again. wain's parameters are live from the start.
+//
+// (2) The live intervals are then handed out registers in order of their start ("linear scan"): when an
+// interval starts, the registers of the intervals that have ended are free again. When there are none free,
+// whichever of the new interval and the ones holding registers ends last is spilled: it lives in the frame,
+// just as without -O, for the whole of its life.
+//
+// A register variable is never stored in the frame. Its register is loaded with its initial value just
+// before the top-level statement in which it is first used (for a parameter, in the prologue), which is
+// always executed once and before any other use of it. Variables that are never used get neither a register
+// nor any code at all.
+
+typedef struct Liveness_ {
+    int        point;                 // The most recent point numbered.
+    int        statement;             // The top-level statement of wain being walked ...
+    int        statementStart;        // ... and the point at which it starts.
+    int        loopDepth;             // # of while loops around the current point ...
+    int        loopStart;             // ... and the point at which the outermost one starts.
+    Symbol  ** touched;               // The variables used so far in the outermost loop ...
+    int        nTouched;              // ... and how many there are.
+} Liveness;
+
+// Note a use of the variable named by the ID leaf tree.
+void noteUse( ParseTree * parse, TreePtr tree, SymbolTable * table, Liveness * live ) {
+    Symbol * sym = symbolFor( parse, tree, table );
+
+    live->point++;
+    if( sym->liveStart == NOT_LIVE ) {
+        sym->liveStart  = live->statementStart;
+        sym->initBefore = live->statement;
+    }
+    if( live->loopDepth > 0 && sym->liveEnd < live->loopStart ) live->touched[live->nTouched++] = sym;
+    sym->liveEnd = live->point;
+}
+
+/* Note the uses of variables in tree, a statement, test or expression, in the order they are executed. */
+void noteUsesIn( ParseTree * parse, TreePtr tree, SymbolTable * table, Liveness * live ) {
+
+    int base = parse->nWork;
+    int idx;
+
+    switch( tree->ruleId ) {
+
+        case RULE_STATEMENTS:
+        case RULE_STATEMENTS_EMPTY:
+            pushLeftSpine( parse, tree );
+            while( parse->nWork > base ) noteUsesIn( parse, childOf(parse,popWork(parse),1), table, live );
+            return;
+
+        case RULE_STATEMENT_ASSIGN:
+            noteUsesIn( parse, childOf(parse,tree,2), table, live );
+            noteUsesIn( parse, childOf(parse,tree,0), table, live );
+            return;
+
+        case RULE_STATEMENT_IF:
+            noteUsesIn( parse, childOf(parse,tree,2), table, live );
+            noteUsesIn( parse, childOf(parse,tree,5), table, live );
+            noteUsesIn( parse, childOf(parse,tree,9), table, live );
+            return;
+
+        case RULE_STATEMENT_WHILE:
+            if( live->loopDepth++ == 0 ) live->loopStart = live->point + 1;
+            noteUsesIn( parse, childOf(parse,tree,2), table, live );
+            noteUsesIn( parse, childOf(parse,tree,5), table, live );
+            if( --live->loopDepth == 0 ) {
+                // Everything used in the loop stays live until it ends.
+                live->point++;
+                for( idx = 0; idx < live->nTouched; idx++ ) live->touched[idx]->liveEnd = live->point;
+                live->nTouched = 0;
+            }
+            return;
+
+        case RULE_STATEMENT_PRINTLN:
+            noteUsesIn( parse, childOf(parse,tree,2), table, live );
+            return;
+
+        case RULE_TEST_EQ: case RULE_TEST_NE: case RULE_TEST_LT:
+        case RULE_TEST_LE: case RULE_TEST_GE: case RULE_TEST_GT:
+            noteUsesIn( parse, childOf(parse,tree,0), table, live );
+            noteUsesIn( parse, childOf(parse,tree,2), table, live );
+            return;
+
+        case RULE_EXPR_TERM:   case RULE_EXPR_PLUS:  case RULE_EXPR_MINUS:
+        case RULE_TERM_FACTOR: case RULE_TERM_STAR:  case RULE_TERM_SLASH: case RULE_TERM_PCT:
+            noteUsesIn( parse, leftmostOperand(parse,pushLeftSpine(parse,tree)), table, live );
+            while( parse->nWork > base ) noteUsesIn( parse, childOf(parse,popWork(parse),2), table, live );
+            return;
+
+        case RULE_FACTOR_ID:
+        case RULE_LVALUE_ID:
+            noteUse( parse, childOf(parse,tree,0), table, live );
+            return;
+
+        case RULE_FACTOR_NUM:
+        case RULE_CONSTANT:
+            return;
+
+        case RULE_FACTOR_PARENS:
+        case RULE_LVALUE_PARENS:
+            noteUsesIn( parse, childOf(parse,tree,1), table, live );
+            return;
+
+        case RULE_BLOCK:
+            if( tree->nChildren > 0 ) noteUsesIn( parse, childOf(parse,tree,0), table, live );
+            return;
+
+        default:
+            break;
+    }
+    bail( parse, tree );
+}
+
+int compareLiveStarts( const void * a, const void * b ) {
+    Symbol * symA = *(Symbol **) a;
+    Symbol * symB = *(Symbol **) b;
+    if( symA->liveStart != symB->liveStart ) return symA->liveStart < symB->liveStart ? -1 : 1;
+    return symB->offset - symA->offset;                                                 // In the order declared.
+}
+
+// Give the variables of procedure (the RULE_PROCEDURE node) registers, as described above. Afterwards
+// table->live lists the variables that are used, in the order their intervals start.
+void allocateRegisters( ParseTree * parse, TreePtr procedure, SymbolTable * table ) {
+
+    int          base = parse->nWork;
+    Liveness     live;
+    Symbol     * active[NUM_VAR_REGS];        // The variables holding registers at the current point.
+    Symbol     * sym;
+    int          nActive  = 0;
+    unsigned     freeRegs = (1u << NUM_VAR_REGS) - 1;
+    int          idx, slot, furthest;
+
+    table->live = countedMalloc( (table->nSymbols + 1) * sizeof(Symbol *) );
+    if( table->live == NULL ) panicExit( "out of memory" );
+    table->nLive = 0;
+
+    for( slot = 0; slot < table->capacity; slot++ ) {
+        sym = &table->slots[slot];
+        if( sym->name == NULL ) continue;
+        sym->reg        = 0;
+        sym->liveStart  = sym->offset > -8 ? 0 : NOT_LIVE;                               // The parameters are set on entry.
+        sym->liveEnd    = NOT_LIVE;
+        sym->initBefore = INIT_IN_PROLOGUE;
+    }
+
+    // The initial values of the dcls.
+    pushLeftSpine( parse, childOf(parse,procedure,8) );
+    while( parse->nWork > base ) {
+        TreePtr dcls = popWork( parse );
+        symbolFor( parse, childOf(parse,childOf(parse,dcls,1),1), table )->value = numberOf( parse, childOf(parse,dcls,3) );
+    }
+
+    // (1) Number the uses, top-level statement by top-level statement; the returned expr counts as one more.
+    memset( &live, 0, sizeof(live) );
+    live.touched = table->live;                                                         // Free until (2).
+    pushLeftSpine( parse, childOf(parse,procedure,9) );
+    while( parse->nWork > base ) {
+        live.statementStart = ++live.point;
+        noteUsesIn( parse, childOf(parse,popWork(parse),1), table, &live );
+        live.statement++;
+    }
+    live.statementStart = ++live.point;
+    noteUsesIn( parse, childOf(parse,procedure,11), table, &live );
+
+    // (2) Linear scan.
+    for( slot = 0; slot < table->capacity; slot++ ) {
+        sym = &table->slots[slot];
+        if( sym->name != NULL && sym->liveEnd != NOT_LIVE ) table->live[table->nLive++] = sym;
+    }
+    qsort( table->live, table->nLive, sizeof(Symbol *), compareLiveStarts );
+
+    for( idx = 0; idx < table->nLive; idx++ ) {
+        sym = table->live[idx];
+        for( slot = 0; slot < nActive; ) {
+            if( active[slot]->liveEnd < sym->liveStart ) {
+                freeRegs |= 1u << (active[slot]->reg - FIRST_VAR_REG);
+                active[slot] = active[--nActive];
+            } else {
+                slot++;
+            }
+        }
+        if( nActive < NUM_VAR_REGS ) {
+            for( slot = 0; ! (freeRegs & (1u << slot)); slot++ ) {}
+            freeRegs &= ~(1u << slot);
+            sym->reg = FIRST_VAR_REG + slot;
+            active[nActive++] = sym;
+        } else {
+            for( furthest = 0, slot = 1; slot < nActive; slot++ ) {
+                if( active[slot]->liveEnd > active[furthest]->liveEnd ) furthest = slot;
+            }
+            if( active[furthest]->liveEnd > sym->liveEnd ) {
+                sym->reg = active[furthest]->reg;
+                active[furthest]->reg = 0;
+                active[furthest] = sym;
+            }
+        }
+    }
+    if( DEBUG ) {
+        for( idx = 0; idx < table->nLive; idx++ ) {
+            sym = table->live[idx];
+            fprintf( stderr, "%.*s: live %d - %d, $%d\n", sym->length, sym->name, sym->liveStart, sym->liveEnd, sym->reg );
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Peephole optimization (-O).
+//
+// -----------------------------------------------------------------------------------------------------
+
+// With -O, pass three keeps all of the generated code in its Emitter and peephole(...) improves it before it
+// is written out. The code is read back into an array of Instructions - one per line, except that a lis and
+// the .word after it make one - and the rules below are applied at every instruction, looking at most
+// PEEPHOLE_WINDOW instructions ahead, over and over until none of them changes anything:
+//
+//     moves    add $a,$a,$0 is removed, as is an instruction whose result is never read. An instruction
+//              whose result is only copied to another register (eg mflo $3, add $12,$3,$0) writes that
+//              register directly. A copy that is overwritten before the register it was copied from (eg
+//              add $3,$18,$0, slt $3,$3,$19) is removed, the instructions in between reading the original.
+//     stack    sub $30,$30,$4 and a later add $30,$30,$4 (or the other way round) cancel out, if the only
+//              instructions in between that depend on $30 are lw's and sw's, whose offsets are adjusted.
+//     stores   a lw from the word that an earlier sw stored to becomes a copy of the register stored, if
+//              nothing in between can have changed either.
+//     jumps    a branch to an unconditional branch goes straight to the latter's target. Branches to the
+//              next instruction, code that can't be reached and labels that nothing refers to are removed.
+//
+// The rules rely on the conventions of the generated code: $4 always holds 4, and memory is only read back
+// where it has been written. A register is only taken to be dead if, within the window, it's written before
+// it's read and before any branch or call. The code is left alone if it contains anything the rules don't
+// understand - a line that isn't recognized, or a branch to a numeric offset.
+
+#define PEEPHOLE_WINDOW    16
+#define MAX_JUMP_CHAIN     8
+#define NO_TARGET          (-1)
+
+/* The MIPS instructions the generated code uses. */
+#define MIPS_OPCODES(X) \
+    X(add)  X(sub)  X(slt)  X(sltu) X(mult) X(multu) X(div)  X(divu) X(mfhi) X(mflo) \
+    X(lis)  X(lw)   X(sw)   X(beq)  X(bne)  X(jr)    X(jalr)
+
+#define AS_OPCODE(name)          OP_##name,
+#define AS_OPCODE_NAME(name)     #name,
+
+typedef enum { MIPS_OPCODES(AS_OPCODE) OP_LABEL, OP_OTHER } Opcode;
+
+char * opcodeNames[] = { MIPS_OPCODES(AS_OPCODE_NAME) };
+
+typedef struct Instruction_ {
+    Opcode   op;
+    int      d, s, t;                 // Registers, named as in "add $d,$s,$t", "lw $d,i($s)", "sw $t,i($s)" and "beq $s,$t,label".
+    int      imm;                     // The offset of a lw or sw.
+    char   * name;                    // A label's name, or the label a branch or lis refers to ...
+    int      nameLength;
+    int      target;                  // ... and the index of that label, or NO_TARGET.
+    int      refs;                    // For a label, the # of instructions referring to it.
+    char   * text;                    // The line(s) as emitted, without the final '\n'.
+    int      length;
+    bool     deleted;
+    bool     changed;                 // Whether the instruction has to be written out afresh from the fields above.
+} Instruction;
+
+typedef struct Peephole_ {
+    Instruction * code;
+    int           nCode;
+    long          removed;            // # of words of machine code removed.
+} Peephole;
+
+// Decode the line text (length characters, without the '\n') into ins. A line that isn't recognized becomes
+// OP_OTHER. A lis is completed by the caller, from the .word line after it.
+void decodeInstruction( char * text, int length, Instruction * ins ) {
+
+    char  line[80], name[8];
+    int   op, used = 0, end = -1;
+
+    memset( ins, 0, sizeof(Instruction) );
+    ins->op     = OP_OTHER;
+    ins->target = NO_TARGET;
+    ins->text   = text;
+    ins->length = length;
+    if( length >= (int) sizeof(line) ) return;
+    memcpy( line, text, length );
+    line[length] = '\0';
+
+    if( length > 1 && line[length-1] == ':' && strchr( line, ' ' ) == NULL ) {
+        ins->op         = OP_LABEL;
+        ins->name       = text;
+        ins->nameLength = length - 1;
+        return;
+    }
+    if( sscanf( line, "%7s%n", name, &used ) != 1 ) return;
+    for( op = 0; op < OP_LABEL && strcmp( name, opcodeNames[op] ); op++ ) {}
+
+    switch( op ) {
+        case OP_add: case OP_sub: case OP_slt: case OP_sltu:
+            sscanf( line + used, " $%d,$%d,$%d%n", &ins->d, &ins->s, &ins->t, &end );
+            break;
+        case OP_mult: case OP_multu: case OP_div: case OP_divu:
+            sscanf( line + used, " $%d,$%d%n", &ins->s, &ins->t, &end );
+            break;
+        case OP_mfhi: case OP_mflo: case OP_lis:
+            sscanf( line + used, " $%d%n", &ins->d, &end );
+            break;
+        case OP_jr: case OP_jalr:
+            sscanf( line + used, " $%d%n", &ins->s, &end );
+            break;
+        case OP_lw:
+            sscanf( line + used, " $%d,%d($%d)%n", &ins->d, &ins->imm, &ins->s, &end );
+            break;
+        case OP_sw:
+            sscanf( line + used, " $%d,%d($%d)%n", &ins->t, &ins->imm, &ins->s, &end );
+            break;
+        case OP_beq: case OP_bne:
+            // Only branches to labels are recognized.
+            sscanf( line + used, " $%d,$%d,%n", &ins->s, &ins->t, &end );
+            if( end < 0 || ! isalpha( (unsigned char) line[used+end] ) ) return;
+            ins->name       = text + used + end;
+            ins->nameLength = length - used - end;
+            end             = length - used;
+            break;
+        default:
+            return;
+    }
+    if( end >= 0 && used + end == length ) ins->op = (Opcode) op;
+}
+
+// The register ins writes, or 0 if none.
+int definedBy( Instruction * ins ) {
+    switch( ins->op ) {
+        case OP_add: case OP_sub: case OP_slt: case OP_sltu:
+        case OP_mfhi: case OP_mflo: case OP_lis: case OP_lw:
+            return ins->d;
+        case OP_jalr:
+            return 31;
+        default:
+            return 0;
+    }
+}
+
+// Whether ins reads register reg.
+bool readsRegister( Instruction * ins, int reg ) {
+    if( reg == 0 ) return false;
+    switch( ins->op ) {
+        case OP_add: case OP_sub: case OP_slt: case OP_sltu:
+        case OP_mult: case OP_multu: case OP_div: case OP_divu:
+        case OP_sw: case OP_beq: case OP_bne:
+            return ins->s == reg || ins->t == reg;
+        case OP_lw: case OP_jr:
+            return ins->s == reg;
+        case OP_jalr:                                         // Whatever is called may read anything.
+        case OP_OTHER:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Whether control may not go on to the next instruction after ins.
+bool transfersControl( Instruction * ins ) {
+    return ins->op == OP_beq || ins->op == OP_bne || ins->op == OP_jr || ins->op == OP_jalr || ins->op == OP_OTHER;
+}
+
+// Whether ins does nothing but write the register given by definedBy(...). lw is left out since it might read
+// from the input.
+bool hasNoSideEffects( Instruction * ins ) {
+    switch( ins->op ) {
+        case OP_add: case OP_sub: case OP_slt: case OP_sltu: case OP_mfhi: case OP_mflo: case OP_lis:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool isUnconditional( Instruction * ins ) {
+    return ins->op == OP_jr || (ins->op == OP_beq && ins->s == ins->t);
+}
+
+// Whether ins copies a register to another, setting *from to the register copied.
+bool isMove( Instruction * ins, int * from ) {
+    if( ins->op == OP_add && ins->t == 0 )                       *from = ins->s;
+    else if( ins->op == OP_add && ins->s == 0 )                  *from = ins->t;
+    else if( ins->op == OP_sub && ins->t == 0 )                  *from = ins->s;
+    else return false;
+    return ins->d != 0;
+}
+
+// The index of the first instruction after idx that hasn't been deleted, or p->nCode.
+int nextInstruction( Peephole * p, int idx ) {
+    for( idx++; idx < p->nCode && p->code[idx].deleted; idx++ ) {}
+    return idx;
+}
+
+// The index of the first instruction after idx that hasn't been deleted and isn't a label, or p->nCode.
+int nextReal( Peephole * p, int idx ) {
+    for( idx = nextInstruction( p, idx ); idx < p->nCode && p->code[idx].op == OP_LABEL; idx = nextInstruction( p, idx ) ) {}
+    return idx;
+}
+
+// Whether the value of register reg after instruction idx is certainly never read.
+bool deadAfter( Peephole * p, int idx, int reg ) {
+    int seen;
+    for( seen = 0, idx = nextReal( p, idx ); idx < p->nCode && seen < PEEPHOLE_WINDOW; idx = nextReal( p, idx ), seen++ ) {
+        Instruction * ins = &p->code[idx];
+        if( readsRegister( ins, reg ) || transfersControl( ins ) ) return false;
+        if( definedBy( ins ) == reg ) return true;
+    }
+    return false;
+}
+
+void deleteInstruction( Peephole * p, int idx ) {
+    Instruction * ins = &p->code[idx];
+    ins->deleted = true;
+    if( ins->target != NO_TARGET ) p->code[ins->target].refs--;
+    if( ins->op != OP_LABEL ) p->removed += ins->op == OP_lis ? 2 : 1;
+}
+
+void setTarget( Peephole * p, Instruction * ins, int target ) {
+    p->code[ins->target].refs--;
+    p->code[target].refs++;
+    ins->target  = target;
+    ins->changed = true;
+}
+
+// moves: see above.
+bool peepholeMoves( Peephole * p, int idx ) {
+    Instruction * ins  = &p->code[idx];
+    int           next = nextInstruction( p, idx );
+    Instruction * use  = &p->code[next < p->nCode ? next : idx];
+    int           from, to, other, seen, defined = definedBy( ins );
+
+    // x = y where x is y, or x = ... where x is never read.
+    if( (isMove( ins, &from ) && from == ins->d) || (defined != 0 && hasNoSideEffects( ins ) && deadAfter( p, idx, defined )) ) {
+        deleteInstruction( p, idx );
+        return true;
+    }
+    if( next >= p->nCode || use->op == OP_LABEL ) return false;
+
+    // x = ...; y = x  ==>  y = ...
+    if( defined != 0 && ins->op != OP_jalr && isMove( use, &from ) && from == defined && use->d != defined && deadAfter( p, next, defined ) ) {
+        ins->d       = use->d;
+        ins->changed = true;
+        deleteInstruction( p, next );
+        return true;
+    }
+
+    // x = y; ... x ...; x = ...  ==>  ... y ...; x = ...
+    if( isMove( ins, &from ) ) {
+        to = ins->d;
+        for( seen = 0, other = next; other < p->nCode && seen < PEEPHOLE_WINDOW; other = nextInstruction( p, other ), seen++ ) {
+            use = &p->code[other];
+            if( use->op == OP_LABEL || transfersControl( use ) ) return false;
+            if( definedBy( use ) == to ) break;
+            if( definedBy( use ) == from ) return false;
+        }
+        if( other >= p->nCode || seen >= PEEPHOLE_WINDOW ) return false;
+        for( other = next; ; other = nextInstruction( p, other ) ) {
+            use = &p->code[other];
+            if( readsRegister( use, to ) ) {
+                if( use->s == to ) use->s = from;
+                if( use->t == to ) use->t = from;
+                use->changed = true;
+            }
+            if( definedBy( use ) == to ) break;
+        }
+        deleteInstruction( p, idx );
+        return true;
+    }
+    return false;
+}
+
+// stack: see above.
+bool peepholeStack( Peephole * p, int idx ) {
+    Instruction * ins = &p->code[idx];
+    Opcode        undo;
+    int           other, seen, adjust;
+
+    if( (ins->op != OP_add && ins->op != OP_sub) || ins->d != 30 || ins->s != 30 || ins->t != 4 ) return false;
+    undo = ins->op == OP_add ? OP_sub : OP_add;
+    for( seen = 0, other = nextInstruction( p, idx ); other < p->nCode && seen < PEEPHOLE_WINDOW; other = nextInstruction( p, other ), seen++ ) {
+        Instruction * next = &p->code[other];
+        if( next->op == undo && next->d == 30 && next->s == 30 && next->t == 4 ) break;
+        if( next->op == OP_LABEL || transfersControl( next ) ) return false;
+        if( definedBy( next ) == 30 || definedBy( next ) == 4 ) return false;
+        if( readsRegister( next, 30 ) && ! ((next->op == OP_lw || next->op == OP_sw) && next->s == 30 && next->t != 30) ) return false;
+    }
+    if( other >= p->nCode || seen >= PEEPHOLE_WINDOW ) return false;
+
+    // In between, $30 was 4 less (after a sub) or 4 more (after an add) than it will be now.
+    adjust = ins->op == OP_sub ? -4 : 4;
+    for( seen = nextInstruction( p, idx ); seen < other; seen = nextInstruction( p, seen ) ) {
+        Instruction * between = &p->code[seen];
+        if( (between->op == OP_lw || between->op == OP_sw) && between->s == 30 ) {
+            between->imm    += adjust;
+            between->changed = true;
+        }
+    }
+    deleteInstruction( p, idx );
+    deleteInstruction( p, other );
+    return true;
+}
+
+// stores: see above.
+bool peepholeStores( Peephole * p, int idx ) {
+    Instruction * ins = &p->code[idx];
+    int           other, seen;
+
+    if( ins->op != OP_sw ) return false;
+    for( seen = 0, other = nextInstruction( p, idx ); other < p->nCode && seen < PEEPHOLE_WINDOW; other = nextInstruction( p, other ), seen++ ) {
+        Instruction * next = &p->code[other];
+        if( next->op == OP_LABEL || transfersControl( next ) ) return false;
+        if( next->op == OP_lw && next->s == ins->s && next->imm == ins->imm ) {
+            if( next->d == ins->t ) {
+                deleteInstruction( p, other );
+            } else {
+                next->op      = OP_add;
+                next->s       = ins->t;
+                next->t       = 0;
+                next->changed = true;
+            }
+            return true;
+        }
+        if( next->op == OP_sw && (next->s != ins->s || abs( next->imm - ins->imm ) < 4) ) return false;
+        if( definedBy( next ) == ins->t || definedBy( next ) == ins->s ) return false;
+    }
+    return false;
+}
+
+// jumps: see above.
+bool peepholeJumps( Peephole * p, int idx ) {
+    Instruction * ins = &p->code[idx];
+    int           label, hops, next;
+
+    if( ins->op == OP_LABEL && ins->refs == 0 ) {
+        deleteInstruction( p, idx );
+        return true;
+    }
+    if( (ins->op == OP_beq || ins->op == OP_bne) ) {
+        // Branch to the next instruction.
+        for( next = nextInstruction( p, idx ); next < p->nCode && p->code[next].op == OP_LABEL; next = nextInstruction( p, next ) ) {
+            if( next == ins->target ) {
+                deleteInstruction( p, idx );
+                return true;
+            }
+        }
+        // Branch to a branch, following the chain only if it ends.
+        for( label = ins->target, hops = 0; hops < MAX_JUMP_CHAIN; hops++ ) {
+            next = nextReal( p, label );
+            if( next >= p->nCode || ! isUnconditional( &p->code[next] ) || p->code[next].op != OP_beq ) break;
+            label = p->code[next].target;
+        }
+        if( hops > 0 && hops < MAX_JUMP_CHAIN ) {
+            setTarget( p, ins, label );
+            return true;
+        }
+    }
+    if( isUnconditional( ins ) ) {
+        // Nothing can reach the instructions after an unconditional branch until the next label.
+        next = nextInstruction( p, idx );
+        if( next < p->nCode && p->code[next].op != OP_LABEL ) {
+            deleteInstruction( p, next );
+            return true;
+        }
+    }
+    return false;
+}
+
+// Read the code in program back into p->code. Returns false if the code contains something the rules don't
+// understand.
+bool decodeProgram( Emitter * program, Peephole * p ) {
+
+    char   * text = program->buffer;
+    size_t   pos  = 0;
+    int    * labels;
+    int      capacity, idx, slot, nLabels = 0;
+
+    p->code = countedMalloc( (program->length / 2 + 1) * sizeof(Instruction) );           // Every line has at least 2 characters.
+    if( p->code == NULL ) panicExit( "out of memory" );
+    while( pos < program->length ) {
+        char        * newline = memchr( text + pos, '\n', program->length - pos );
+        size_t        end     = newline != NULL ? (size_t) (newline - text) : program->length;
+        Instruction * ins     = &p->code[p->nCode++];
+
+        decodeInstruction( text + pos, end - pos, ins );
+        pos = end + 1;
+        if( ins->op == OP_LABEL ) nLabels++;
+        if( ins->op == OP_lis ) {
+            // The .word line belongs to the lis.
+            newline = pos < program->length ? memchr( text + pos, '\n', program->length - pos ) : NULL;
+            end     = newline != NULL ? (size_t) (newline - text) : program->length;
+            if( pos >= program->length || end - pos < 7 || strncmp( text + pos, ".word ", 6 ) ) return false;
+            if( isalpha( (unsigned char) text[pos+6] ) ) {
+                ins->name       = text + pos + 6;
+                ins->nameLength = end - pos - 6;
+            }
+            ins->length = end - (ins->text - text);
+            pos         = end + 1;
+        }
+        if( ins->op == OP_OTHER ) return false;
+    }
+
+    // Resolve the references to labels through a hash table of the labels.
+    for( capacity = 16; capacity < 2 * nLabels; capacity *= 2 ) {}
+    labels = countedMalloc( capacity * sizeof(int) );
+    if( labels == NULL ) panicExit( "out of memory" );
+    for( slot = 0; slot < capacity; slot++ ) labels[slot] = NO_TARGET;
+    for( idx = 0; idx < p->nCode; idx++ ) {
+        Instruction * label = &p->code[idx];
+        if( label->op != OP_LABEL ) continue;
+        slot = hashString( label->name, label->nameLength ) & (capacity - 1);
+        while( labels[slot] != NO_TARGET ) slot = (slot + 1) & (capacity - 1);
+        labels[slot] = idx;
+    }
+    for( idx = 0; idx < p->nCode; idx++ ) {
+        Instruction * ins = &p->code[idx];
+        if( ins->op == OP_LABEL || ins->name == NULL ) continue;
+        slot = hashString( ins->name, ins->nameLength ) & (capacity - 1);
+        for( ; labels[slot] != NO_TARGET; slot = (slot + 1) & (capacity - 1) ) {
+            Instruction * label = &p->code[labels[slot]];
+            if( label->nameLength == ins->nameLength && ! memcmp( label->name, ins->name, ins->nameLength ) ) break;
+        }
+        if( labels[slot] == NO_TARGET ) {
+            free( labels );
+            return false;
+        }
+        ins->target = labels[slot];
+        p->code[ins->target].refs++;
+    }
+    free( labels );
+    return true;
+}
+
+// Write ins to out.
+void encodeInstruction( Peephole * p, Instruction * ins, Emitter * out ) {
+    Instruction * label = ins->target != NO_TARGET ? &p->code[ins->target] : NULL;
+
+    if( ! ins->changed ) {
+        emitBytes( out, ins->text, ins->length );
+        emitString( out, "\n" );
+        return;
+    }
+    switch( ins->op ) {
+        case OP_add: case OP_sub: case OP_slt: case OP_sltu:
+            emit( out, "%s $%d,$%d,$%d\n", opcodeNames[ins->op], ins->d, ins->s, ins->t );
+            break;
+        case OP_mult: case OP_multu: case OP_div: case OP_divu:
+            emit( out, "%s $%d,$%d\n", opcodeNames[ins->op], ins->s, ins->t );
+            break;
+        case OP_mfhi: case OP_mflo:
+            emit( out, "%s $%d\n", opcodeNames[ins->op], ins->d );
+            break;
+        case OP_lis: {
+            // The .word line is kept as it was.
+            char * word = (char *) memchr( ins->text, '\n', ins->length ) + 1;
+            emit( out, "lis $%d\n", ins->d );
+            emitBytes( out, word, ins->length - (word - ins->text) );
+            emitString( out, "\n" );
+            break;
+        }
+        case OP_lw:
+            emit( out, "lw $%d,%d($%d)\n", ins->d, ins->imm, ins->s );
+            break;
+        case OP_sw:
+            emit( out, "sw $%d,%d($%d)\n", ins->t, ins->imm, ins->s );
+            break;
+        case OP_beq: case OP_bne:
+            emit( out, "%s $%d,$%d,%.*s\n", opcodeNames[ins->op], ins->s, ins->t, label->nameLength, label->name );
+            break;
+        default:
+            emit( out, "%s $%d\n", opcodeNames[ins->op], ins->s );
+            break;
+    }
+}
+
+/* Improve the code held in program (which must have no sink), as described above. Returns the number of words
+   of machine code removed. */
+long peephole( Emitter * program ) {
+
+    Peephole   p;
+    Emitter  * out;
+    bool       changed = true;
+    int        idx;
+
+    memset( &p, 0, sizeof(p) );
+    if( ! decodeProgram( program, &p ) ) {
+        free( p.code );
+        return 0;
+    }
+    while( changed ) {
+        changed = false;
+        for( idx = 0; idx < p.nCode; idx++ ) {
+            if( p.code[idx].deleted ) continue;
+            changed = peepholeJumps( &p, idx ) || changed;
+            if( p.code[idx].deleted ) continue;
+            changed = peepholeMoves( &p, idx ) || changed;
+            if( p.code[idx].deleted ) continue;
+            changed = peepholeStack( &p, idx ) || changed;
+            if( p.code[idx].deleted ) continue;
+            changed = peepholeStores( &p, idx ) || changed;
+        }
+    }
+
+    // Write the improved code to a new buffer and swap it into program.
+    out = newEmitter( NULL );
+    for( idx = 0; idx < p.nCode; idx++ ) {
+        if( ! p.code[idx].deleted ) encodeInstruction( &p, &p.code[idx], out );
+    }
+    free( p.code );
+    free( program->buffer );
+    program->buffer       = out->buffer;
+    program->length       = out->length;
+    program->capacity     = out->capacity;
+    program->bytesEmitted = out->bytesEmitted;
+    free( out );
+    return p.removed;
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Misc helpers.
+//
+// -----------------------------------------------------------------------------------------------------
+
+// All errors - in the input or otherwise - are reported through reportError(...), which formats the
+// message into errorMessage. While a program is being compiled by compile(...) errorRecovery is set and
+// reportError(...) longjmp's back to compile(...), which cleans up and returns false, so that in batch mode
+// one bad input doesn't bring down the whole batch. Otherwise the message is printed on stderr and the
+// program exits, reporting a non-zero status code.
+void reportError( char * format, ... ) {
+    va_list args;
+    int     length = snprintf( errorMessage, sizeof(errorMessage), "ERROR: " );
+
+    va_start( args, format );
+    vsnprintf( errorMessage + length, sizeof(errorMessage) - length, format, args );
+    va_end( args );
+
+    if( errorRecovery != NULL ) longjmp( *errorRecovery, 1 );
+    fprintf( stderr, "%s\n", errorMessage );
+    exit(1);
+}
+
+// Report an un-recogized rule.
+void bail( ParseTree * parse, TreePtr tree ) {
+    char rule[ERROR_MESSAGE_SIZE];
+    formatRule( parse, tree, rule, sizeof(rule) );
+    reportError( "unrecognized rule %s", rule );
+}
+
+// Report a more general disaster.
+void panicExit( char * rule ) {
+    reportError( "%s", rule );
+}
+
+// -----------------------------------------------------------------------------------------------------
+//
+// Useful when debugging.
+//
+// -----------------------------------------------------------------------------------------------------
+
+void printSymbolTable( SymbolTable * table ) {
+    int idx;
+    fprintf( stderr, "%d symbols:\n", table->nSymbols );
+    for( idx = 0; idx < table->capacity; idx++ ) {
+        Symbol * sym = &table->slots[idx];
+        if( sym->name != NULL ) {
+            fprintf( stderr, "    %.*s %s %d\n", sym->length, sym->name, symbolNames[sym->type], sym->offset );
+        }
+    }
+}
+
+// Format a node the way it appeared in the *.wli file, truncating it if it won't fit in size bytes.
+void formatRule( ParseTree * parse, TreePtr tree, char * buffer, size_t size ) {
+    size_t length = 0;
+    int    idx;
+
+    #define APPEND(...) length += snprintf( buffer + length, length < size ? size - length : 0, __VA_ARGS__ )
+    if( tree->ruleId == RULE_UNKNOWN ) {
+        APPEND( "%.*s", tree->lexemeLength, lexemeOf(parse,tree) );
+        return;
+    }
+    APPEND( "%s", tree->symbol == SYM_UNKNOWN ? "?" : symbolNames[tree->symbol] );
+    if( tree->ruleId == RULE_TERMINAL ) APPEND( " %.*s", tree->lexemeLength, lexemeOf(parse,tree) );
+    if( tree->ruleId == RULE_CONSTANT ) APPEND( " = %d", constantOf(tree) );
+    for( idx = 0; idx < tree->nChildren; idx++ ) {
+        SymbolId sym = childOf(parse,tree,idx)->symbol;
+        APPEND( " %s", sym == SYM_UNKNOWN ? "?" : symbolNames[sym] );
+    }
+    #undef APPEND
+}
+
+void printRule( ParseTree * parse, TreePtr tree ) {
+    char rule[ERROR_MESSAGE_SIZE];
+    formatRule( parse, tree, rule, sizeof(rule) );
+    fprintf( stderr, "%s\n", rule );
 }
 
-void printTreeNode( TreePtr tree ) {
+void printTreeNode( ParseTree * parse, TreePtr tree ) {
     fprintf( stderr, "\n" );
     if( tree == NULL ) {
         fprintf( stderr, "ptr is <null>\n" );
     } else {
         fprintf( stderr, ".rule      = " );
-        printStringPtrArray( tree->rule );
+        printRule( parse, tree );
         fprintf( stderr, ".nChildren = %d\n", tree->nChildren );
         int idx;
         for( idx = 0; idx < tree->nChildren; idx++ ) {
             fprintf( stderr, "    %2d: ", idx );
-            TreePtr child = (*(tree->children))[idx];
-            printStringPtrArray( child->rule );
+            printRule( parse, childOf(parse,tree,idx) );
         }
     }
 }
 
-void printTree( TreePtr tree ) {
+void printTree( ParseTree * parse, TreePtr tree ) {
     if( tree == NULL ) {
         return;
     } else {
-        printStringPtrArray( tree->rule );
+        printRule( parse, tree );
         int idx;
         for( idx = 0; idx < tree->nChildren; idx++ ) {
-            printTree( (*(tree->children))[idx] );
+            printTree( parse, childOf(parse,tree,idx) );
         }
     }
 }
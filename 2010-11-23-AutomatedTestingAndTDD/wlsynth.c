@@ -0,0 +1,169 @@
+/*
+ * Generates synthetic WL programs, as *.wli parse trees, for benchmarking wlgen.
+ *
+ *     wlsynth SHAPE NODES [DEPTH] > prog.wli
+ *
+ * writes a program of roughly NODES parse tree nodes whose bulk has the given shape:
+ *
+ *     statements   a long list of statements: a = a + b; (with a println(a); every 4th)
+ *     dcls         a long list of declarations: int v0 = 0; int v1 = 1; ...
+ *     expr         one deeply nested expression: return a + (a + (a + ... (a)));
+ *     nest         many blocks of while and if statements nested DEPTH (default 64) deep
+ *
+ * The output is what java cs241.WLParse would produce for such a program. The programs are only meant to be
+ * compiled, not run - the while loops in "nest" never terminate, for instance.
+ *
+ * The benchmark harness (wlbench.c) #include's this file with WLSYNTH_NO_MAIN defined and calls
+ * synthesizeProgram(...) directly.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { SHAPE_STATEMENTS, SHAPE_DCLS, SHAPE_EXPR, SHAPE_NEST, NUM_SHAPES, SHAPE_UNKNOWN = -1 } Shape;
+
+char * shapeNames[NUM_SHAPES] = { "statements", "dcls", "expr", "nest" };
+
+#define DEFAULT_NEST_DEPTH 64
+#define FIXED_NODES        30               // Roughly the # of nodes in the rest of the program.
+
+Shape shapeFor( char * name ) {
+    int shape;
+    for( shape = 0; shape < NUM_SHAPES; shape++ ) {
+        if( ! strcmp( name, shapeNames[shape] ) ) return (Shape) shape;
+    }
+    return SHAPE_UNKNOWN;
+}
+
+// The whole program, save the dcls, statements and returned expression.
+char * synthHead =
+    "S BOF procedure EOF\n"
+    "BOF BOF\n"
+    "procedure INT WAIN LPAREN dcl COMMA dcl RPAREN LBRACE dcls statements RETURN expr SEMI RBRACE\n"
+    "INT int\n"  "WAIN wain\n"  "LPAREN (\n"
+    "dcl INT ID\n"  "INT int\n"  "ID a\n"
+    "COMMA ,\n"
+    "dcl INT ID\n"  "INT int\n"  "ID b\n"
+    "RPAREN )\n"  "LBRACE {\n";
+
+char * synthTail = "SEMI ;\n"  "RBRACE }\n"  "EOF EOF\n";
+
+char * synthExprA    = "expr term\n"  "term factor\n"  "factor ID\n"  "ID a\n";
+char * synthTestAB   = "test expr LT expr\n"
+                       "expr term\n"  "term factor\n"  "factor ID\n"  "ID a\n"
+                       "LT <\n"
+                       "expr term\n"  "term factor\n"  "factor ID\n"  "ID b\n";
+
+// The nodes of a left-recursive list of count items (eg statements --> statements statement) appear in
+// preorder as count list nodes, then the empty list, then the items in order.
+void synthListSpine( FILE * out, char * rule, char * emptyRule, long count ) {
+    long idx;
+    for( idx = 0; idx < count; idx++ ) fputs( rule, out );
+    fputs( emptyRule, out );
+}
+
+void synthStatements( FILE * out, long nodes ) {
+    long count = (nodes - FIXED_NODES) * 4 / 55;           // 55 nodes for every 4 statements.
+    long idx;
+    if( count < 1 ) count = 1;
+    synthListSpine( out, "statements statements statement\n", "statements\n", count );
+    for( idx = 0; idx < count; idx++ ) {
+        if( idx % 4 == 0 ) {
+            fputs( "statement PRINTLN LPAREN expr RPAREN SEMI\n"  "PRINTLN println\n"  "LPAREN (\n", out );
+            fputs( synthExprA, out );
+            fputs( "RPAREN )\n"  "SEMI ;\n", out );
+        } else {
+            fputs( "statement lvalue BECOMES expr SEMI\n"  "lvalue ID\n"  "ID a\n"  "BECOMES =\n"
+                   "expr expr PLUS term\n", out );
+            fputs( synthExprA, out );
+            fputs( "PLUS +\n"  "term factor\n"  "factor ID\n"  "ID b\n"  "SEMI ;\n", out );
+        }
+    }
+}
+
+void synthDcls( FILE * out, long nodes ) {
+    long count = (nodes - FIXED_NODES) / 7;                // 7 nodes per declaration.
+    long idx;
+    if( count < 1 ) count = 1;
+    synthListSpine( out, "dcls dcls dcl BECOMES NUM SEMI\n", "dcls\n", count );
+    for( idx = 0; idx < count; idx++ ) {
+        fprintf( out, "dcl INT ID\n"  "INT int\n"  "ID v%ld\n"  "BECOMES =\n"  "NUM %ld\n"  "SEMI ;\n", idx, idx % 1000 );
+    }
+}
+
+// a + (a + (a + ... (a))), with depth pairs of parentheses.
+void synthNestedExpr( FILE * out, long nodes ) {
+    long depth = (nodes - FIXED_NODES) / 10;               // 10 nodes per level.
+    long idx;
+    if( depth < 1 ) depth = 1;
+    for( idx = 0; idx < depth; idx++ ) {
+        fputs( "expr expr PLUS term\n", out );
+        fputs( synthExprA, out );
+        fputs( "PLUS +\n"  "term factor\n"  "factor LPAREN expr RPAREN\n"  "LPAREN (\n", out );
+    }
+    fputs( synthExprA, out );
+    for( idx = 0; idx < depth; idx++ ) fputs( "RPAREN )\n", out );
+}
+
+// count blocks, each of while and if statements alternately nested depth deep.
+void synthNest( FILE * out, long nodes, int depth ) {
+    long count = (nodes - FIXED_NODES) / (19L * depth);     // About 19 nodes per level.
+    long idx;
+    int  level;
+    if( count < 1 ) count = 1;
+    synthListSpine( out, "statements statements statement\n", "statements\n", count );
+    for( idx = 0; idx < count; idx++ ) {
+        for( level = 0; level < depth; level++ ) {
+            if( level > 0 ) fputs( "statements statements statement\n"  "statements\n", out );
+            if( level % 2 == 0 ) {
+                fputs( "statement WHILE LPAREN test RPAREN LBRACE statements RBRACE\n"  "WHILE while\n", out );
+            } else {
+                fputs( "statement IF LPAREN test RPAREN LBRACE statements RBRACE ELSE LBRACE statements RBRACE\n"  "IF if\n", out );
+            }
+            fputs( "LPAREN (\n", out );
+            fputs( synthTestAB, out );
+            fputs( "RPAREN )\n"  "LBRACE {\n", out );
+        }
+        fputs( "statements\n", out );
+        for( level = depth - 1; level >= 0; level-- ) {
+            fputs( "RBRACE }\n", out );
+            if( level % 2 == 1 ) fputs( "ELSE else\n"  "LBRACE {\n"  "statements\n"  "RBRACE }\n", out );
+        }
+    }
+}
+
+// Write a program of roughly nodes parse tree nodes with the given shape to out.
+void synthesizeProgram( FILE * out, Shape shape, long nodes, int depth ) {
+    fputs( synthHead, out );
+    if( shape == SHAPE_DCLS ) synthDcls( out, nodes );
+    else                      fputs( "dcls\n", out );
+    if( shape == SHAPE_STATEMENTS ) synthStatements( out, nodes );
+    else if( shape == SHAPE_NEST )  synthNest( out, nodes, depth );
+    else                            fputs( "statements\n", out );
+    fputs( "RETURN return\n", out );
+    if( shape == SHAPE_EXPR ) synthNestedExpr( out, nodes );
+    else                      fputs( synthExprA, out );
+    fputs( synthTail, out );
+}
+
+#ifndef WLSYNTH_NO_MAIN
+
+int main( int argc, char * argv[] ) {
+    Shape shape = argc >= 3 ? shapeFor( argv[1] ) : SHAPE_UNKNOWN;
+    long  nodes = argc >= 3 ? atol( argv[2] ) : 0;
+    int   depth = argc >= 4 ? atoi( argv[3] ) : DEFAULT_NEST_DEPTH;
+
+    if( argc > 4 || shape == SHAPE_UNKNOWN || nodes <= 0 || depth <= 0 ) {
+        fprintf( stderr, "usage: %s statements|dcls|expr|nest NODES [DEPTH] > prog.wli\n", argv[0] );
+        return 1;
+    }
+    static char buffer[1 << 16];
+    setvbuf( stdout, buffer, _IOFBF, sizeof(buffer) );
+    synthesizeProgram( stdout, shape, nodes, depth );
+    return fflush( stdout ) == 0 ? 0 : 1;
+}
+
+#endif // WLSYNTH_NO_MAIN